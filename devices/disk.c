@@ -2,14 +2,35 @@
 #include <ctype.h>
 #include <debug.h>
 #include <stdbool.h>
+#include <list.h>
 #include <stdio.h>
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   Transfers go through a request queue on each channel.  A caller
+   queues its request and sleeps until it is done; it does not hold
+   the channel meanwhile.  The queue is kept in sector order and
+   served as a C-SCAN elevator: the next command starts with the
+   first request at or past the sector where the last one ended,
+   wrapping around to the lowest sector.  Queued requests that
+   continue it in the same direction, even from other threads, are
+   merged into the same command.
+
+   If the channel has a PCI bus-master IDE function, as QEMU's PIIX
+   does, and the buffers suit it, a command is a single READ DMA or
+   WRITE DMA, and the controller interrupts when the data is in
+   place.  Otherwise it is a READ SECTORS or WRITE SECTORS done in
+   PIO mode by the thread that starts it.
+
+   Starting a request needs interrupts on, to wait for the device,
+   so the interrupt handler only finishes requests.  Whoever
+   finishes one, or finds the channel idle, starts the next. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -31,7 +52,9 @@
 /* Alternate Status Register bits. */
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
+#define STA_DF 0x20             /* Device Fault. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -47,6 +70,67 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Bus-master IDE registers, relative to a channel's BM_BASE. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0)  /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)   /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)     /* PRD table. */
+
+/* Bus-master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* Transfer into memory. */
+
+/* Bus-master Status Register bits. */
+#define BM_STA_ACTIVE 0x01      /* Transfer in progress. */
+#define BM_STA_ERR 0x02         /* Error; write 1 to clear. */
+#define BM_STA_INTR 0x04        /* Device interrupted; write 1 to clear. */
+
+/* PCI configuration space access. */
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+#define PCI_COMMAND 0x04        /* Command register. */
+#define PCI_CLASS 0x08          /* Class, subclass, prog-if, revision. */
+#define PCI_BAR4 0x20           /* Base address 4: bus-master registers. */
+#define PCI_COMMAND_IO 0x01     /* Respond to I/O space accesses. */
+#define PCI_COMMAND_MASTER 0x04 /* Allow bus mastering. */
+
+/* A physical region descriptor: one piece of a DMA buffer.  It may
+   not cross a 64 kB boundary; a SIZE of 0 means 64 kB. */
+struct prd {
+	uint32_t addr;              /* Physical address. */
+	uint16_t size;              /* Bytes. */
+	uint16_t flags;             /* PRD_EOT on the last one. */
+};
+#define PRD_EOT 0x8000
+
+/* Descriptors per channel.  Every buffer of every merged request
+   needs at least one, so a gather write of single sectors can move
+   up to this many in one command. */
+#define PRD_CNT 64
+
+/* Most sectors a single command can move. */
+#define DISK_MAX_SECTORS 256
+
+/* Set to false to do every transfer in PIO mode. */
+bool disk_use_dma = true;
+
+/* A queued transfer.  Its sectors are split evenly over BUFFER_CNT
+   buffers, which need not be contiguous in memory. */
+struct disk_request {
+	struct list_elem elem;      /* In channel's QUEUE or ACTIVE. */
+	struct disk *disk;          /* Disk to transfer with. */
+	disk_sector_t sec_no;       /* First sector. */
+	size_t cnt;                 /* Number of sectors. */
+	void *const *buffers;       /* BUFFER_CNT buffers, in disk order. */
+	size_t buffer_cnt;          /* Number of BUFFERS. */
+	size_t buffer_sectors;      /* Sectors in each buffer. */
+	bool write;                 /* Write to disk, or read from it? */
+	bool dma;                   /* Transfer by bus-master DMA? */
+	bool error;                 /* Did the transfer fail? */
+	struct semaphore done;      /* Up'd when the transfer is over. */
+};
 
 /* An ATA device. */
 struct disk {
@@ -55,10 +139,12 @@ struct disk {
 	int dev_no;                 /* Device 0 or 1 for master or slave. */
 
 	bool is_ata;                /* 1=This device is an ATA disk. */
+	bool dma;                   /* Supports DMA (if is_ata)? */
 	disk_sector_t capacity;     /* Capacity in sectors (if is_ata). */
 
 	long long read_cnt;         /* Number of sectors read. */
 	long long write_cnt;        /* Number of sectors written. */
+	long long cmd_cnt;          /* Number of transfer commands. */
 };
 
 /* An ATA channel (aka controller).
@@ -67,8 +153,14 @@ struct channel {
 	char name[8];               /* Name, e.g. "hd0". */
 	uint16_t reg_base;          /* Base I/O port. */
 	uint8_t irq;                /* Interrupt in use. */
+	uint16_t bm_base;           /* Bus-master I/O port, or 0 if none. */
+	struct prd *prdt;           /* PRD table for DMA. */
+
+	struct list queue;          /* Requests waiting, in sector order. */
+	struct list active;         /* Requests in the command in progress. */
+	bool active_dma;            /* Is that command a DMA? */
+	disk_sector_t head;         /* Sector after the last command. */
 
-	struct lock lock;           /* Must acquire to access the controller. */
 	bool expecting_interrupt;   /* True if an interrupt is expected, false if
 								   any interrupt would be spurious. */
 	struct semaphore completion_wait;   /* Up'd by interrupt handler. */
@@ -80,11 +172,18 @@ struct channel {
 #define CHANNEL_CNT 2
 static struct channel channels[CHANNEL_CNT];
 
+/* PRD tables.  Aligned to their size, so that none crosses a 64 kB
+   boundary. */
+static struct prd prd_tables[CHANNEL_CNT][PRD_CNT]
+	__attribute__ ((aligned (CHANNEL_CNT * PRD_CNT * sizeof (struct prd))));
+
+static uint16_t find_bus_master (void);
+
 static void reset_channel (struct channel *);
 static bool check_device_type (struct disk *);
 static void identify_ata_device (struct disk *);
 
-static void select_sector (struct disk *, disk_sector_t);
+static void select_sector (struct disk *, disk_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -94,11 +193,23 @@ static bool wait_while_busy (const struct disk *);
 static void select_device (const struct disk *);
 static void select_device_wait (const struct disk *);
 
+static void disk_transfer (struct disk *, disk_sector_t,
+		void *const buffers[], size_t buffer_cnt, size_t buffer_sectors,
+		bool write);
+static void disk_transfer_vector (struct disk *, disk_sector_t,
+		void *const buffers[], size_t buffer_cnt, size_t buffer_sectors,
+		bool write);
+static void channel_dispatch (struct channel *);
+static void pio_transfer (struct channel *);
+static void dma_start (struct channel *);
+static void channel_complete (struct channel *, bool error);
+
 static void interrupt_handler (struct intr_frame *);
 
 /* Initialize the disk subsystem and detect disks. */
 void
 disk_init (void) {
+	uint16_t bm_base = find_bus_master ();
 	size_t chan_no;
 
 	for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++) {
@@ -119,7 +230,12 @@ disk_init (void) {
 			default:
 				NOT_REACHED ();
 		}
-		lock_init (&c->lock);
+		c->bm_base = bm_base != 0 ? bm_base + chan_no * 8 : 0;
+		c->prdt = prd_tables[chan_no];
+		list_init (&c->queue);
+		list_init (&c->active);
+		c->active_dma = false;
+		c->head = 0;
 		c->expecting_interrupt = false;
 		sema_init (&c->completion_wait, 0);
 
@@ -131,9 +247,10 @@ disk_init (void) {
 			d->dev_no = dev_no;
 
 			d->is_ata = false;
+			d->dma = false;
 			d->capacity = 0;
 
-			d->read_cnt = d->write_cnt = 0;
+			d->read_cnt = d->write_cnt = d->cmd_cnt = 0;
 		}
 
 		/* Register interrupt handler. */
@@ -167,8 +284,8 @@ disk_print_stats (void) {
 		for (dev_no = 0; dev_no < 2; dev_no++) {
 			struct disk *d = disk_get (chan_no, dev_no);
 			if (d != NULL && d->is_ata)
-				printf ("%s: %lld reads, %lld writes\n",
-						d->name, d->read_cnt, d->write_cnt);
+				printf ("%s: %lld reads, %lld writes in %lld commands\n",
+						d->name, d->read_cnt, d->write_cnt, d->cmd_cnt);
 		}
 	}
 }
@@ -209,21 +326,7 @@ disk_size (struct disk *d) {
    per-disk locking is unneeded. */
 void
 disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
-	struct channel *c;
-
-	ASSERT (d != NULL);
-	ASSERT (buffer != NULL);
-
-	c = d->channel;
-	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
-	issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-	sema_down (&c->completion_wait);
-	if (!wait_while_busy (d))
-		PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-	input_sector (c, buffer);
-	d->read_cnt++;
-	lock_release (&c->lock);
+	disk_transfer (d, sec_no, &buffer, 1, 1, false);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -233,23 +336,389 @@ disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
    per-disk locking is unneeded. */
 void
 disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer) {
+	void *p = (void *) buffer;
+
+	disk_transfer (d, sec_no, &p, 1, 1, true);
+}
+
+/* Reads the CNT sectors starting at SEC_NO from disk D into BUFFER,
+   which must have room for CNT * DISK_SECTOR_SIZE bytes, in as few
+   commands as possible. */
+void
+disk_read_multiple (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		void *buffer) {
+	uint8_t *p = buffer;
+
+	while (cnt > 0) {
+		size_t chunk = cnt < DISK_MAX_SECTORS ? cnt : DISK_MAX_SECTORS;
+		void *chunk_buffer = p;
+
+		disk_transfer (d, sec_no, &chunk_buffer, 1, chunk, false);
+		sec_no += chunk;
+		cnt -= chunk;
+		p += chunk * DISK_SECTOR_SIZE;
+	}
+}
+
+/* Writes the CNT sectors starting at SEC_NO to disk D from BUFFER,
+   which must contain CNT * DISK_SECTOR_SIZE bytes, in as few
+   commands as possible. */
+void
+disk_write_multiple (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		const void *buffer) {
+	const uint8_t *p = buffer;
+
+	while (cnt > 0) {
+		size_t chunk = cnt < DISK_MAX_SECTORS ? cnt : DISK_MAX_SECTORS;
+		void *chunk_buffer = (void *) p;
+
+		disk_transfer (d, sec_no, &chunk_buffer, 1, chunk, true);
+		sec_no += chunk;
+		cnt -= chunk;
+		p += chunk * DISK_SECTOR_SIZE;
+	}
+}
+
+/* Reads the BUFFER_CNT * BUFFER_SECTORS sectors starting at SEC_NO
+   from disk D, BUFFER_SECTORS into each of BUFFERS in turn, in as
+   few commands as possible.  The buffers need not be contiguous:
+   each gets its own DMA descriptors. */
+void
+disk_read_scatter (struct disk *d, disk_sector_t sec_no,
+		void *const buffers[], size_t buffer_cnt, size_t buffer_sectors) {
+	disk_transfer_vector (d, sec_no, buffers, buffer_cnt, buffer_sectors,
+			false);
+}
+
+/* Writes the BUFFER_CNT * BUFFER_SECTORS sectors starting at SEC_NO
+   to disk D, BUFFER_SECTORS from each of BUFFERS in turn, in as few
+   commands as possible. */
+void
+disk_write_gather (struct disk *d, disk_sector_t sec_no,
+		void *const buffers[], size_t buffer_cnt, size_t buffer_sectors) {
+	disk_transfer_vector (d, sec_no, buffers, buffer_cnt, buffer_sectors,
+			true);
+}
+
+/* Returns the number of PRDs the SIZE bytes at BUFFER need.  Kernel
+   memory is mapped at a 64 kB aligned offset, so virtual addresses
+   cross 64 kB boundaries where physical ones do. */
+static size_t
+buffer_prd_cnt (const void *buffer, size_t size) {
+	uint64_t start = (uintptr_t) buffer;
+	uint64_t end = start + size;
+
+	return ((end - 1) >> 16) - (start >> 16) + 1;
+}
+
+/* Transfers BUFFER_CNT buffers of BUFFER_SECTORS sectors each,
+   starting at SEC_NO, as a few requests that each fit in a single
+   command. */
+static void
+disk_transfer_vector (struct disk *d, disk_sector_t sec_no,
+		void *const buffers[], size_t buffer_cnt, size_t buffer_sectors,
+		bool write) {
+	size_t size = buffer_sectors * DISK_SECTOR_SIZE;
+
+	ASSERT (buffer_sectors > 0 && buffer_sectors <= DISK_MAX_SECTORS);
+
+	while (buffer_cnt > 0) {
+		size_t cnt = 0, prds = 0;
+
+		while (cnt < buffer_cnt
+				&& (cnt + 1) * buffer_sectors <= DISK_MAX_SECTORS) {
+			size_t p = buffer_prd_cnt (buffers[cnt], size);
+			if (cnt > 0 && prds + p > PRD_CNT)
+				break;
+			prds += p;
+			cnt++;
+		}
+
+		disk_transfer (d, sec_no, buffers, cnt, buffer_sectors, write);
+		sec_no += cnt * buffer_sectors;
+		buffers += cnt;
+		buffer_cnt -= cnt;
+	}
+}
+
+/* Returns true if the SIZE bytes at BUFFER can be reached by
+   bus-master DMA: kernel memory, which is physically contiguous,
+   word aligned and below 4 GB. */
+static bool
+dma_reachable (const void *buffer, size_t size) {
+	return is_kernel_vaddr (buffer)
+		&& ((uintptr_t) buffer & 1) == 0
+		&& vtop (buffer) + size <= UINT32_MAX;
+}
+
+/* Returns the number of PRDs that request R's buffers need. */
+static size_t
+prd_cnt (const struct disk_request *r) {
+	size_t size = r->buffer_sectors * DISK_SECTOR_SIZE;
+	size_t cnt = 0;
+
+	for (size_t i = 0; i < r->buffer_cnt; i++)
+		cnt += buffer_prd_cnt (r->buffers[i], size);
+	return cnt;
+}
+
+/* Returns sector I of request R in its buffers. */
+static uint8_t *
+request_sector (const struct disk_request *r, size_t i) {
+	return (uint8_t *) r->buffers[i / r->buffer_sectors]
+		+ i % r->buffer_sectors * DISK_SECTOR_SIZE;
+}
+
+/* Orders disk requests by first sector. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+		void *aux UNUSED) {
+	const struct disk_request *a = list_entry (a_, struct disk_request, elem);
+	const struct disk_request *b = list_entry (b_, struct disk_request, elem);
+
+	return a->sec_no < b->sec_no;
+}
+
+/* Transfers the BUFFER_CNT * BUFFER_SECTORS sectors starting at
+   SEC_NO between disk D and BUFFERS, BUFFER_SECTORS per buffer:
+   reads them into the buffers, or writes them from them if WRITE is
+   true.  Queues the transfer on D's channel and sleeps until it is
+   over. */
+static void
+disk_transfer (struct disk *d, disk_sector_t sec_no,
+		void *const buffers[], size_t buffer_cnt, size_t buffer_sectors,
+		bool write) {
+	size_t cnt = buffer_cnt * buffer_sectors;
 	struct channel *c;
+	struct disk_request r;
+	enum intr_level old_level;
+	size_t i;
 
 	ASSERT (d != NULL);
-	ASSERT (buffer != NULL);
+	ASSERT (buffers != NULL);
+	ASSERT (cnt > 0 && cnt <= DISK_MAX_SECTORS);
+	ASSERT (sec_no + cnt <= d->capacity);
 
 	c = d->channel;
-	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
-	issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-	if (!wait_while_busy (d))
-		PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-	output_sector (c, buffer);
-	sema_down (&c->completion_wait);
-	d->write_cnt++;
-	lock_release (&c->lock);
+	r.disk = d;
+	r.sec_no = sec_no;
+	r.cnt = cnt;
+	r.buffers = buffers;
+	r.buffer_cnt = buffer_cnt;
+	r.buffer_sectors = buffer_sectors;
+	r.write = write;
+	r.dma = disk_use_dma && c->bm_base != 0 && d->dma;
+	for (i = 0; i < buffer_cnt && r.dma; i++)
+		r.dma = dma_reachable (buffers[i], buffer_sectors * DISK_SECTOR_SIZE);
+	r.error = false;
+	sema_init (&r.done, 0);
+
+	old_level = intr_disable ();
+	list_insert_ordered (&c->queue, &r.elem, request_less, NULL);
+	intr_set_level (old_level);
+
+	channel_dispatch (c);
+	sema_down (&r.done);
+
+	/* Start whatever queued up behind this request. */
+	channel_dispatch (c);
+
+	if (r.error)
+		PANIC ("%s: disk %s failed, sector=%"PRDSNu, d->name,
+				write ? "write" : "read", sec_no);
+	if (write)
+		d->write_cnt += cnt;
+	else
+		d->read_cnt += cnt;
 }
-
+
+/* Moves the requests for the next command from channel C's queue
+   to its active list.  The channel must be idle and its queue not
+   empty.  Interrupts must be off. */
+static void
+channel_pick (struct channel *c) {
+	struct disk_request *first, *r;
+	struct list_elem *e;
+	disk_sector_t next;
+	size_t sectors, prds;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (list_empty (&c->active));
+	ASSERT (!list_empty (&c->queue));
+
+	/* C-SCAN: the first request at or past the head, or else the
+	   lowest one. */
+	for (e = list_begin (&c->queue); e != list_end (&c->queue);
+			e = list_next (e))
+		if (list_entry (e, struct disk_request, elem)->sec_no >= c->head)
+			break;
+	if (e == list_end (&c->queue))
+		e = list_begin (&c->queue);
+	first = list_entry (e, struct disk_request, elem);
+
+	/* Take along the requests that continue it. */
+	next = first->sec_no;
+	sectors = prds = 0;
+	while (e != list_end (&c->queue)) {
+		r = list_entry (e, struct disk_request, elem);
+		if (r != first
+				&& (r->disk != first->disk || r->write != first->write
+					|| r->dma != first->dma || r->sec_no != next
+					|| sectors + r->cnt > DISK_MAX_SECTORS
+					|| (r->dma && prds + prd_cnt (r) > PRD_CNT)))
+			break;
+
+		next = r->sec_no + r->cnt;
+		sectors += r->cnt;
+		if (r->dma)
+			prds += prd_cnt (r);
+		e = list_remove (e);
+		list_push_back (&c->active, &r->elem);
+	}
+
+	c->active_dma = first->dma;
+	c->head = next;
+	first->disk->cmd_cnt++;
+}
+
+/* Starts the commands queued on channel C, unless one is already in
+   progress.  A DMA command is left running for the interrupt
+   handler to finish; PIO commands are done here and now. */
+static void
+channel_dispatch (struct channel *c) {
+	enum intr_level old_level;
+
+	for (;;) {
+		old_level = intr_disable ();
+		if (!list_empty (&c->active) || list_empty (&c->queue)) {
+			intr_set_level (old_level);
+			return;
+		}
+		channel_pick (c);
+		intr_set_level (old_level);
+
+		if (c->active_dma) {
+			dma_start (c);
+			return;
+		}
+		pio_transfer (c);
+	}
+}
+
+/* Ends the command in progress on channel C and wakes up the
+   threads waiting for its requests.  Interrupts must be off. */
+static void
+channel_complete (struct channel *c, bool error) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	while (!list_empty (&c->active)) {
+		struct disk_request *r = list_entry (list_pop_front (&c->active),
+				struct disk_request, elem);
+		r->error = error;
+		sema_up (&r->done);
+	}
+}
+
+/* Does the command in progress on channel C in PIO mode: a single
+   READ SECTORS or WRITE SECTORS for all of its sectors, which
+   interrupts once per sector. */
+static void
+pio_transfer (struct channel *c) {
+	struct disk_request *first =
+		list_entry (list_front (&c->active), struct disk_request, elem);
+	struct disk *d = first->disk;
+	enum intr_level old_level;
+	bool error = false;
+	size_t cnt = 0;
+	struct list_elem *e;
+
+	for (e = list_begin (&c->active); e != list_end (&c->active);
+			e = list_next (e))
+		cnt += list_entry (e, struct disk_request, elem)->cnt;
+
+	select_sector (d, first->sec_no, cnt);
+	issue_pio_command (c, first->write ? CMD_WRITE_SECTOR_RETRY
+			: CMD_READ_SECTOR_RETRY);
+	for (e = list_begin (&c->active); e != list_end (&c->active) && !error;
+			e = list_next (e)) {
+		struct disk_request *r = list_entry (e, struct disk_request, elem);
+
+		for (size_t i = 0; i < r->cnt && !error; i++) {
+			uint8_t *sector = request_sector (r, i);
+
+			if (!r->write) {
+				sema_down (&c->completion_wait);
+				if (!wait_while_busy (d))
+					error = true;
+				else
+					input_sector (c, sector);
+			} else {
+				if (!wait_while_busy (d))
+					error = true;
+				else {
+					output_sector (c, sector);
+					sema_down (&c->completion_wait);
+				}
+			}
+		}
+	}
+
+	old_level = intr_disable ();
+	channel_complete (c, error);
+	intr_set_level (old_level);
+}
+
+/* Starts the command in progress on channel C as a single DMA.
+   The interrupt handler ends it. */
+static void
+dma_start (struct channel *c) {
+	struct disk_request *first =
+		list_entry (list_front (&c->active), struct disk_request, elem);
+	enum intr_level old_level;
+	struct prd *prd = c->prdt;
+	size_t cnt = 0;
+	struct list_elem *e;
+
+	/* Describe the buffers, split at 64 kB boundaries. */
+	for (e = list_begin (&c->active); e != list_end (&c->active);
+			e = list_next (e)) {
+		struct disk_request *r = list_entry (e, struct disk_request, elem);
+
+		for (size_t i = 0; i < r->buffer_cnt; i++) {
+			uint64_t addr = vtop (r->buffers[i]);
+			size_t size = r->buffer_sectors * DISK_SECTOR_SIZE;
+
+			while (size > 0) {
+				size_t chunk = 0x10000 - (addr & 0xffff);
+				if (chunk > size)
+					chunk = size;
+
+				ASSERT (prd < c->prdt + PRD_CNT);
+				prd->addr = addr;
+				prd->size = chunk & 0xffff;
+				prd->flags = 0;
+				prd++;
+				addr += chunk;
+				size -= chunk;
+			}
+		}
+		cnt += r->cnt;
+	}
+	prd[-1].flags = PRD_EOT;
+
+	outb (reg_bm_command (c), 0);
+	outl (reg_bm_prdt (c), vtop (c->prdt));
+	outb (reg_bm_status (c), inb (reg_bm_status (c)) | BM_STA_ERR | BM_STA_INTR);
+	outb (reg_bm_command (c), first->write ? 0 : BM_CMD_READ);
+
+	select_sector (first->disk, first->sec_no, cnt);
+
+	old_level = intr_disable ();
+	outb (reg_command (c), first->write ? CMD_WRITE_DMA : CMD_READ_DMA);
+	outb (reg_bm_command (c), inb (reg_bm_command (c)) | BM_CMD_START);
+	intr_set_level (old_level);
+}
+
 /* Disk detection and identification. */
 
 static void print_ata_string (char *string, size_t size);
@@ -364,6 +833,9 @@ identify_ata_device (struct disk *d) {
 	/* Calculate capacity. */
 	d->capacity = id[60] | ((uint32_t) id[61] << 16);
 
+	/* Word 49, bit 8: DMA supported. */
+	d->dma = (id[49] & 0x100) != 0;
+
 	/* Print identification message. */
 	printf ("%s: detected %'"PRDSNu" sector (", d->name, d->capacity);
 	if (d->capacity > 1024 / DISK_SECTOR_SIZE * 1024 * 1024)
@@ -402,17 +874,18 @@ print_ata_string (char *string, size_t size) {
 }
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the count CNT of sectors to transfer to the
+   disk's sector selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct disk *d, disk_sector_t sec_no) {
+select_sector (struct disk *d, disk_sector_t sec_no, size_t cnt) {
 	struct channel *c = d->channel;
 
 	ASSERT (sec_no < d->capacity);
 	ASSERT (sec_no < (1UL << 28));
+	ASSERT (cnt > 0 && cnt <= DISK_MAX_SECTORS);
 
 	select_device_wait (d);
-	outb (reg_nsect (c), 1);
+	outb (reg_nsect (c), cnt == DISK_MAX_SECTORS ? 0 : cnt);
 	outb (reg_lbal (c), sec_no);
 	outb (reg_lbam (c), sec_no >> 8);
 	outb (reg_lbah (c), (sec_no >> 16));
@@ -446,6 +919,61 @@ output_sector (struct channel *c, const void *sector) {
 	outsw (reg_data (c), sector, DISK_SECTOR_SIZE / 2);
 }
 
+/* PCI bus-master IDE detection. */
+
+/* Reads the 32-bit PCI configuration register REG of function FN
+   of device DEV on bus 0. */
+static uint32_t
+pci_read_config (int dev, int fn, int reg) {
+	outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (fn << 8) | reg);
+	return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes VALUE to PCI configuration register REG of function FN of
+   device DEV on bus 0. */
+static void
+pci_write_config (int dev, int fn, int reg, uint32_t value) {
+	outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (fn << 8) | reg);
+	outl (PCI_CONFIG_DATA, value);
+}
+
+/* Looks on PCI bus 0 for an IDE controller that can be a bus
+   master, enables bus mastering on it and returns the base I/O port
+   of its bus-master registers.  Returns 0 if there is none, or if
+   DMA is turned off. */
+static uint16_t
+find_bus_master (void) {
+	int dev, fn;
+
+	if (!disk_use_dma)
+		return 0;
+
+	for (dev = 0; dev < 32; dev++)
+		for (fn = 0; fn < 8; fn++) {
+			uint32_t class, bar4;
+
+			if ((pci_read_config (dev, fn, 0) & 0xffff) == 0xffff)
+				continue;
+
+			/* Class 01h (mass storage), subclass 01h (IDE), prog-if bit
+			   7 (bus master). */
+			class = pci_read_config (dev, fn, PCI_CLASS);
+			if ((class >> 16) != 0x0101 || !(class & 0x8000))
+				continue;
+
+			bar4 = pci_read_config (dev, fn, PCI_BAR4);
+			if (!(bar4 & 1))
+				continue;
+
+			pci_write_config (dev, fn, PCI_COMMAND,
+					pci_read_config (dev, fn, PCI_COMMAND)
+					| PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+			printf ("ide: bus-master DMA at port %#x\n", bar4 & 0xfffc);
+			return bar4 & 0xfffc;
+		}
+	return 0;
+}
+
 /* Low-level ATA primitives. */
 
 /* Wait up to 10 seconds for the controller to become idle, that
@@ -518,7 +1046,22 @@ interrupt_handler (struct intr_frame *f) {
 
 	for (c = channels; c < channels + CHANNEL_CNT; c++)
 		if (f->vec_no == c->irq) {
-			if (c->expecting_interrupt) {
+			if (!list_empty (&c->active) && c->active_dma) {
+				uint8_t bm_status = inb (reg_bm_status (c));
+				uint8_t status;
+
+				if (!(bm_status & BM_STA_INTR))
+					return;
+
+				/* Stop the engine, acknowledge the interrupt and clear the
+				   bus-master status. */
+				outb (reg_bm_command (c), 0);
+				status = inb (reg_status (c));
+				outb (reg_bm_status (c), bm_status | BM_STA_ERR | BM_STA_INTR);
+
+				channel_complete (c, (bm_status & BM_STA_ERR) != 0
+						|| (status & (STA_ERR | STA_DF)) != 0);
+			} else if (c->expecting_interrupt) {
 				inb (reg_status (c));               /* Acknowledge interrupt. */
 				sema_up (&c->completion_wait);      /* Wake up waiter. */
 			} else
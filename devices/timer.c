@@ -3,11 +3,14 @@
 #include <inttypes.h>
 #include <round.h>
 #include <stdio.h>
+#include <string.h>
 #include "threads/interrupt.h"
 #include "threads/io.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
-#include "lib/kernel/list.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
 
 /* See [8254] for hardware details of the 8254 timer chip. */
 
@@ -25,11 +28,22 @@ static int64_t ticks;
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
-/* List of processes in THREAD_BLOCKED state, that is, processes
-   that are blocked (slept) . */
-static struct list block_list;
+/* Binary min-heap of processes sleeping in timer_sleep(), ordered
+   by alarm_tick.  The root is the next thread to wake up, and its
+   alarm_tick is cached in next_wakeup so that ticks with nothing
+   due cost a single comparison. */
+static struct thread **sleep_heap;
+static size_t sleep_heap_cnt;           /* # of sleeping threads. */
+static size_t sleep_heap_cap;           /* # of slots in sleep_heap. */
+static int64_t next_wakeup = INT64_MAX; /* Earliest alarm_tick. */
+
+/* Statistics. */
+static uint64_t interrupt_cycles;       /* # of TSC cycles in handler. */
 
 static intr_handler_func timer_interrupt;
+static void sleep_heap_grow (void);
+static void sleep_heap_push (struct thread *);
+static struct thread *sleep_heap_pop (void);
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
@@ -40,7 +54,8 @@ static void real_time_sleep (int64_t num, int32_t denom);
 void
 timer_init (void) {
 
-    list_init (&block_list);
+    sleep_heap_cap = PGSIZE / sizeof *sleep_heap;
+    sleep_heap = palloc_get_page (PAL_ASSERT);
 
     /* 8254 input frequency divided by TIMER_FREQ, rounded to
        nearest. */
@@ -111,7 +126,14 @@ timer_sleep (int64_t ticks) {
         curr -> alarm_tick = start + ticks;
 
         enum intr_level old_intr_level = intr_disable();
-        list_push_back(&block_list, &curr->elem);
+        while (sleep_heap_cnt == sleep_heap_cap) {
+            /* palloc may sleep on its pool lock, so grow with
+             * interrupts restored and check again afterward. */
+            intr_set_level(old_intr_level);
+            sleep_heap_grow();
+            old_intr_level = intr_disable();
+        }
+        sleep_heap_push(curr);
         thread_block();
         intr_set_level(old_intr_level);
     }
@@ -135,6 +157,16 @@ timer_nsleep (int64_t ns) {
 	real_time_sleep (ns, 1000 * 1000 * 1000);
 }
 
+/* Returns the number of TSC cycles spent in the timer interrupt
+   handler since the OS booted. */
+uint64_t
+timer_interrupt_cycles (void) {
+	enum intr_level old_level = intr_disable ();
+	uint64_t cycles = interrupt_cycles;
+	intr_set_level (old_level);
+	return cycles;
+}
+
 /* Prints timer statistics. */
 void
 timer_print_stats (void) {
@@ -144,7 +176,7 @@ timer_print_stats (void) {
 /* Timer interrupt handler. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED) {
-    struct list_elem* current_list_elem;
+    uint64_t start = rdtsc ();
 
     ticks ++;
     thread_tick ();
@@ -155,33 +187,101 @@ timer_interrupt (struct intr_frame *args UNUSED) {
          * recent_cpu is incremented by 1 for the running thread */
         mlfqs_increment_cpu();
 
-        /* Once per second (per TIMER_FREQ),
-        * the value of recent_cpu is recalculated for every thread */
+        /* Once per second (per TIMER_FREQ), load_avg is updated and
+        * a new recent_cpu decay epoch starts; threads other than the
+        * running one apply the decay lazily when next examined */
         if (ticks % TIMER_FREQ == 0) {
             mlfqs_load_avg();
             mlfqs_recalculate_cpu();
         }
 
-        /* Once every fourth clock tick,
-        * priority is recalculated for every thread. */
+        /* Once every fourth clock tick, priority is recalculated
+        * for the running thread and a bounded batch of ready threads. */
         if (ticks % 4 == 0) {
             mlfqs_recalculate_priority();
         }
     }
 
-    if (!list_empty(&block_list)) {
-        current_list_elem = list_begin(&block_list);
-
-        while (current_list_elem != list_end(&block_list)) {
-            struct thread *target_thread = list_entry (current_list_elem, struct thread, elem);
-            if (ticks >= target_thread->alarm_tick ) {
-                current_list_elem = list_remove (current_list_elem);
-                thread_unblock(target_thread);
-            } else {
-                current_list_elem = list_next (current_list_elem);
-            }
-        }
-    }
+    /* Wake up every sleeper whose alarm has gone off. */
+    while (ticks >= next_wakeup)
+        thread_unblock(sleep_heap_pop());
+
+    interrupt_cycles += rdtsc () - start;
+}
+
+/* Doubles the capacity of sleep_heap.  Must be called with
+   interrupts on, because palloc_get_multiple() may sleep. */
+static void
+sleep_heap_grow (void) {
+	size_t old_cap = sleep_heap_cap;
+	size_t page_cnt = old_cap * 2 * sizeof *sleep_heap / PGSIZE;
+	struct thread **new_heap = palloc_get_multiple (PAL_ASSERT, page_cnt);
+	struct thread **old_heap = sleep_heap;
+	enum intr_level old_level;
+
+	old_level = intr_disable ();
+	if (sleep_heap_cap != old_cap) {
+		/* Another thread grew the heap while we were allocating. */
+		intr_set_level (old_level);
+		palloc_free_multiple (new_heap, page_cnt);
+		return;
+	}
+	memcpy (new_heap, sleep_heap, sleep_heap_cnt * sizeof *sleep_heap);
+	sleep_heap = new_heap;
+	sleep_heap_cap = old_cap * 2;
+	intr_set_level (old_level);
+
+	palloc_free_multiple (old_heap, page_cnt / 2);
+}
+
+/* Inserts T, whose alarm_tick is set, into sleep_heap.  There
+   must be a free slot.  Interrupts must be off. */
+static void
+sleep_heap_push (struct thread *t) {
+	size_t i;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (sleep_heap_cnt < sleep_heap_cap);
+
+	/* Sift up. */
+	for (i = sleep_heap_cnt++; i > 0; i = (i - 1) / 2) {
+		struct thread *parent = sleep_heap[(i - 1) / 2];
+		if (parent->alarm_tick <= t->alarm_tick)
+			break;
+		sleep_heap[i] = parent;
+	}
+	sleep_heap[i] = t;
+	next_wakeup = sleep_heap[0]->alarm_tick;
+}
+
+/* Removes and returns the sleeping thread with the earliest
+   alarm_tick.  sleep_heap must not be empty.  Interrupts must be
+   off. */
+static struct thread *
+sleep_heap_pop (void) {
+	struct thread *min, *last;
+	size_t i, child;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (sleep_heap_cnt > 0);
+
+	min = sleep_heap[0];
+	last = sleep_heap[--sleep_heap_cnt];
+
+	/* Sift LAST down from the root. */
+	for (i = 0; (child = 2 * i + 1) < sleep_heap_cnt; i = child) {
+		if (child + 1 < sleep_heap_cnt
+				&& sleep_heap[child + 1]->alarm_tick < sleep_heap[child]->alarm_tick)
+			child++;
+		if (last->alarm_tick <= sleep_heap[child]->alarm_tick)
+			break;
+		sleep_heap[i] = sleep_heap[child];
+	}
+	if (sleep_heap_cnt > 0)
+		sleep_heap[i] = last;
+
+	next_wakeup = sleep_heap_cnt > 0 ? sleep_heap[0]->alarm_tick : INT64_MAX;
+	return min;
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
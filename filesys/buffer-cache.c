@@ -0,0 +1,382 @@
+#include "filesys/buffer-cache.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Buffer cache.  Holds BUFFER_CACHE_SIZE sectors of the file system
+ * disk.  Writes only dirty the cached copy; dirty sectors go to disk
+ * when they are evicted, every FLUSH_INTERVAL ticks from kworkerd,
+ * and when the file system is shut down.  Victims are chosen with a
+ * second-chance clock.  A dirty sector is written back together with
+ * the dirty sectors cached on either side of it, and read-ahead brings
+ * in a run of sectors, each as one disk command.
+ *
+ * CACHE_LOCK protects every entry, the clock hand and the read-ahead
+ * queue.  It is released for disk I/O: the entries being read or
+ * written are marked busy, the clock passes them over, and a thread
+ * that needs one waits on IO_DONE, so that threads hitting other
+ * sectors do not wait for the disk.  The lock is never held while
+ * the caller's buffer is accessed either: data goes through a bounce
+ * sector on the stack, so that a page fault on the buffer, which may
+ * need file I/O of its own, cannot re-enter the cache with the lock
+ * held. */
+
+/* Ticks between periodic flushes of dirty sectors.  Long enough that
+ * a sector rewritten in a loop goes to disk once, not once a pass. */
+#define FLUSH_INTERVAL (5 * TIMER_FREQ)
+
+/* Requests waiting for read-ahead. */
+#define READAHEAD_QUEUE_SIZE 16
+
+/* Most sectors read ahead for one request. */
+#define READAHEAD_MAX 16
+
+/* Most dirty sectors written back in one request. */
+#define WRITEBACK_MAX 16
+
+/* A cached sector.  DATA comes first so that it is word aligned, as
+ * DMA needs. */
+struct cache_entry {
+	uint8_t data[DISK_SECTOR_SIZE];     /* Contents of SECTOR. */
+	disk_sector_t sector;               /* Sector held. */
+	bool valid;                         /* Holds SECTOR? */
+	bool dirty;                         /* Differs from disk? */
+	bool accessed;                      /* Used since the clock passed? */
+	bool busy;                          /* Being read or written back? */
+};
+
+static struct cache_entry cache[BUFFER_CACHE_SIZE];
+static struct lock cache_lock;
+static struct condition io_done;        /* Broadcast when I/O ends. */
+static size_t clock_hand;               /* Next entry the clock looks at. */
+
+/* A read-ahead request. */
+struct readahead {
+	disk_sector_t sector;               /* First sector. */
+	size_t cnt;                         /* Sectors from SECTOR on. */
+};
+
+/* Read-ahead requests, a ring. */
+static struct readahead readahead_queue[READAHEAD_QUEUE_SIZE];
+static size_t readahead_head;           /* Next request to serve. */
+static size_t readahead_cnt;            /* Requests in the queue. */
+static struct semaphore readahead_sema; /* Upped once per request. */
+
+/* Statistics. */
+static long long hit_cnt;               /* Sectors found in the cache. */
+static long long miss_cnt;              /* Sectors read from disk. */
+static long long readahead_sector_cnt;  /* Sectors read ahead. */
+static long long writeback_cnt;         /* Dirty sectors written back. */
+
+static void cache_readahead (disk_sector_t sector, size_t cnt);
+static void kworkerd (void *aux);
+static void readaheadd (void *aux);
+
+/* Initializes the buffer cache and starts its daemons. */
+void
+buffer_cache_init (void) {
+	lock_init (&cache_lock);
+	cond_init (&io_done);
+	sema_init (&readahead_sema, 0);
+	thread_create ("kworkerd", PRI_DEFAULT, kworkerd, NULL);
+	thread_create ("readaheadd", PRI_DEFAULT, readaheadd, NULL);
+}
+
+/* Returns the entry that holds SECTOR, or a null pointer.  The entry
+ * may be busy.  CACHE_LOCK must be held. */
+static struct cache_entry *
+cache_lookup (disk_sector_t sector) {
+	for (size_t i = 0; i < BUFFER_CACHE_SIZE; i++)
+		if (cache[i].valid && cache[i].sector == sector)
+			return &cache[i];
+	return NULL;
+}
+
+/* Ends the I/O on the CNT entries of RUN and wakes the threads
+ * waiting for any of them.  CACHE_LOCK must be held. */
+static void
+cache_io_done (struct cache_entry *run[], size_t cnt) {
+	for (size_t i = 0; i < cnt; i++)
+		run[i]->busy = false;
+	cond_broadcast (&io_done, &cache_lock);
+}
+
+/* Writes E back to disk if it is dirty and not busy, together with
+ * the dirty sectors cached right before and after it, up to
+ * WRITEBACK_MAX in all, in one gathered write.  CACHE_LOCK must be
+ * held; it is released during the write. */
+static void
+cache_writeback (struct cache_entry *e) {
+	struct cache_entry *run[WRITEBACK_MAX];
+	void *buffers[WRITEBACK_MAX];
+	struct cache_entry *f;
+	disk_sector_t first;
+	size_t cnt = 0;
+
+	if (!e->valid || !e->dirty || e->busy)
+		return;
+
+	first = e->sector;
+	while (e->sector - first < WRITEBACK_MAX - 1 && first > 0
+			&& (f = cache_lookup (first - 1)) != NULL && f->dirty && !f->busy)
+		first--;
+	while (cnt < WRITEBACK_MAX
+			&& (f = cache_lookup (first + cnt)) != NULL && f->dirty && !f->busy) {
+		f->busy = true;
+		run[cnt] = f;
+		buffers[cnt] = f->data;
+		cnt++;
+	}
+
+	lock_release (&cache_lock);
+	disk_write_gather (filesys_disk, first, buffers, cnt, 1);
+	lock_acquire (&cache_lock);
+
+	for (size_t i = 0; i < cnt; i++)
+		run[i]->dirty = false;
+	cache_io_done (run, cnt);
+	writeback_cnt += cnt;
+}
+
+/* Picks an entry with the clock, writes it back if it is dirty and
+ * returns it, invalid.  Busy entries are passed over; if every entry
+ * is busy, waits for one to be done.  CACHE_LOCK must be held; it may
+ * be released, so the caller must look its sector up again. */
+static struct cache_entry *
+cache_evict (void) {
+	struct cache_entry *e;
+	size_t busy_cnt = 0;
+
+	for (;;) {
+		e = &cache[clock_hand];
+		clock_hand = (clock_hand + 1) % BUFFER_CACHE_SIZE;
+
+		if (e->busy) {
+			if (++busy_cnt == BUFFER_CACHE_SIZE) {
+				cond_wait (&io_done, &cache_lock);
+				busy_cnt = 0;
+			}
+			continue;
+		}
+		busy_cnt = 0;
+
+		if (!e->valid)
+			return e;
+		if (e->accessed)
+			e->accessed = false;
+		else
+			break;
+	}
+
+	/* E is busy during the write, so it is still ours afterwards. */
+	cache_writeback (e);
+	e->valid = false;
+	return e;
+}
+
+/* Returns the entry for SECTOR, bringing it in on a miss, once it is
+ * not busy.  Its data is read from disk unless FILL is false, in
+ * which case the caller overwrites all of it.  CACHE_LOCK must be
+ * held; it is released while waiting and during the read. */
+static struct cache_entry *
+cache_get (disk_sector_t sector, bool fill) {
+	struct cache_entry *e;
+
+	for (;;) {
+		e = cache_lookup (sector);
+		if (e != NULL && !e->busy) {
+			hit_cnt++;
+			break;
+		} else if (e != NULL)
+			cond_wait (&io_done, &cache_lock);
+		else {
+			e = cache_evict ();
+			if (cache_lookup (sector) != NULL)
+				continue;
+
+			e->sector = sector;
+			e->valid = true;
+			e->dirty = false;
+			miss_cnt++;
+			if (fill) {
+				e->busy = true;
+				lock_release (&cache_lock);
+				disk_read (filesys_disk, sector, e->data);
+				lock_acquire (&cache_lock);
+				cache_io_done (&e, 1);
+			}
+			break;
+		}
+	}
+	e->accessed = true;
+	return e;
+}
+
+/* Reads SIZE bytes starting at OFS of SECTOR into BUFFER. */
+void
+buffer_cache_read (disk_sector_t sector, void *buffer, int ofs, int size) {
+	uint8_t bounce[DISK_SECTOR_SIZE];
+	struct cache_entry *e;
+
+	ASSERT (ofs >= 0 && size >= 0 && ofs + size <= DISK_SECTOR_SIZE);
+
+	lock_acquire (&cache_lock);
+	e = cache_get (sector, true);
+	memcpy (bounce, e->data + ofs, size);
+	lock_release (&cache_lock);
+
+	memcpy (buffer, bounce, size);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR starting at OFS.  The
+ * sector is only read from disk if the write does not cover it. */
+void
+buffer_cache_write (disk_sector_t sector, const void *buffer, int ofs,
+		int size) {
+	uint8_t bounce[DISK_SECTOR_SIZE];
+	struct cache_entry *e;
+
+	ASSERT (ofs >= 0 && size >= 0 && ofs + size <= DISK_SECTOR_SIZE);
+
+	memcpy (bounce, buffer, size);
+
+	lock_acquire (&cache_lock);
+	e = cache_get (sector, size < DISK_SECTOR_SIZE);
+	memcpy (e->data + ofs, bounce, size);
+	e->dirty = true;
+	lock_release (&cache_lock);
+}
+
+/* Asks readaheadd to bring the CNT sectors starting at SECTOR, or
+ * READAHEAD_MAX of them if that is fewer, into the cache.  Returns at
+ * once; the request is dropped if SECTOR is cached already or the
+ * queue is full. */
+void
+buffer_cache_readahead (disk_sector_t sector, size_t cnt) {
+	if (cnt == 0)
+		return;
+	if (cnt > READAHEAD_MAX)
+		cnt = READAHEAD_MAX;
+
+	lock_acquire (&cache_lock);
+	if (readahead_cnt < READAHEAD_QUEUE_SIZE && cache_lookup (sector) == NULL) {
+		readahead_queue[(readahead_head + readahead_cnt++)
+			% READAHEAD_QUEUE_SIZE] = (struct readahead) {
+				.sector = sector,
+				.cnt = cnt,
+			};
+		sema_up (&readahead_sema);
+	}
+	lock_release (&cache_lock);
+}
+
+/* Reads the first run of uncached sectors among the CNT starting at
+ * SECTOR, or READAHEAD_MAX of them if that is fewer, into the cache
+ * now, as cache_readahead() does.  For a caller about to read them
+ * all, which would otherwise miss on each in turn. */
+void
+buffer_cache_prefetch (disk_sector_t sector, size_t cnt) {
+	if (cnt > READAHEAD_MAX)
+		cnt = READAHEAD_MAX;
+
+	lock_acquire (&cache_lock);
+	cache_readahead (sector, cnt);
+	lock_release (&cache_lock);
+}
+
+/* Writes every dirty sector back to disk. */
+void
+buffer_cache_flush (void) {
+	lock_acquire (&cache_lock);
+	for (size_t i = 0; i < BUFFER_CACHE_SIZE; i++)
+		cache_writeback (&cache[i]);
+	lock_release (&cache_lock);
+}
+
+/* Prints buffer cache statistics. */
+void
+buffer_cache_print_stats (void) {
+	printf ("Buffer cache: %lld hits, %lld misses, %lld read ahead, "
+			"%lld written back\n",
+			hit_cnt, miss_cnt, readahead_sector_cnt, writeback_cnt);
+}
+
+/* Flushes dirty sectors every FLUSH_INTERVAL ticks, so that a crash
+ * loses at most that much work. */
+static void
+kworkerd (void *aux UNUSED) {
+	for (;;) {
+		timer_sleep (FLUSH_INTERVAL);
+		buffer_cache_flush ();
+	}
+}
+
+/* Reads in the run of sectors from SECTOR on that is not cached,
+ * skipping any cached at its start and stopping at the first cached
+ * after that or after CNT sectors, with one scattered read.  A sector
+ * read ahead is not marked accessed, so it is the first to go if it is
+ * never used.  CACHE_LOCK must be held; it is released during the
+ * read. */
+static void
+cache_readahead (disk_sector_t sector, size_t cnt) {
+	struct cache_entry *run[READAHEAD_MAX];
+	void *buffers[READAHEAD_MAX];
+	struct cache_entry *e;
+	size_t n = 0;
+
+	ASSERT (cnt <= READAHEAD_MAX);
+
+	while (cnt > 0 && cache_lookup (sector) != NULL) {
+		sector++;
+		cnt--;
+	}
+
+	/* Entries are claimed for the run as they are found, and stay
+	 * busy until it is read, so that the clock cannot evict one to
+	 * make room for another and readers of the sectors wait.  The
+	 * run ends early if another thread brings in its next sector
+	 * while cache_evict() writes back. */
+	while (n < cnt && cache_lookup (sector + n) == NULL) {
+		e = cache_evict ();
+		if (cache_lookup (sector + n) != NULL)
+			break;
+		e->sector = sector + n;
+		e->valid = true;
+		e->dirty = false;
+		e->accessed = false;
+		e->busy = true;
+		run[n] = e;
+		buffers[n] = e->data;
+		n++;
+	}
+	if (n == 0)
+		return;
+
+	lock_release (&cache_lock);
+	disk_read_scatter (filesys_disk, sector, buffers, n, 1);
+	lock_acquire (&cache_lock);
+
+	cache_io_done (run, n);
+	readahead_sector_cnt += n;
+}
+
+/* Serves read-ahead requests. */
+static void
+readaheadd (void *aux UNUSED) {
+	struct readahead ra;
+
+	for (;;) {
+		sema_down (&readahead_sema);
+
+		lock_acquire (&cache_lock);
+		ra = readahead_queue[readahead_head];
+		readahead_head = (readahead_head + 1) % READAHEAD_QUEUE_SIZE;
+		readahead_cnt--;
+		cache_readahead (ra.sector, ra.cnt);
+		lock_release (&cache_lock);
+	}
+}
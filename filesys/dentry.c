@@ -0,0 +1,167 @@
+#include "filesys/dentry.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/synch.h"
+
+/* Dentry cache.  Maps a name in a directory, keyed on the
+ * directory's inode sector, to the sector of the file's inode, so
+ * that resolving a path does not open every directory on the way.
+ * A negative entry records that a name does not exist.
+ *
+ * dir_add() drops the entry for a name it adds and dir_remove() makes
+ * the entry for a name it removes negative, so the cache never
+ * disagrees with the directories.  When it is full, the least
+ * recently used entry is reused. */
+
+/* A cached name. */
+struct dentry {
+	struct hash_elem hash_elem;         /* In DENTRIES, if in use. */
+	struct list_elem lru_elem;          /* In LRU_LIST. */
+	disk_sector_t parent;               /* Sector of the directory. */
+	disk_sector_t sector;               /* Inode sector, or DENTRY_NEGATIVE. */
+	bool is_dir;                        /* Is SECTOR a directory? */
+	bool in_use;                        /* In DENTRIES? */
+	char name[NAME_MAX + 1];            /* Null terminated file name. */
+};
+
+static struct dentry dentry_pool[DENTRY_CACHE_SIZE];
+static struct hash dentries;            /* Entries in use, by PARENT and NAME. */
+static struct list lru_list;            /* Every entry, most recent first. */
+static struct lock dentry_lock;         /* Protects the above. */
+
+/* Statistics. */
+static long long hit_cnt;               /* Lookups answered. */
+static long long negative_hit_cnt;      /* Of those, negative. */
+static long long miss_cnt;              /* Lookups not answered. */
+
+static uint64_t
+dentry_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+	return hash_string (d->name) ^ hash_int (d->parent);
+}
+
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+	const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+
+	if (a->parent != b->parent)
+		return a->parent < b->parent;
+	return strcmp (a->name, b->name) < 0;
+}
+
+/* Initializes the dentry cache. */
+void
+dentry_init (void) {
+	if (!hash_init (&dentries, dentry_hash, dentry_less, NULL))
+		PANIC ("dentry cache creation failed");
+	list_init (&lru_list);
+	lock_init (&dentry_lock);
+
+	for (size_t i = 0; i < DENTRY_CACHE_SIZE; i++)
+		list_push_back (&lru_list, &dentry_pool[i].lru_elem);
+}
+
+/* Returns the entry for NAME in PARENT, or a null pointer.
+ * DENTRY_LOCK must be held. */
+static struct dentry *
+dentry_find (disk_sector_t parent, const char *name) {
+	struct dentry key;
+	struct hash_elem *e;
+
+	key.parent = parent;
+	strlcpy (key.name, name, sizeof key.name);
+	e = hash_find (&dentries, &key.hash_elem);
+	return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/* Looks up NAME in the directory whose inode is at PARENT.  Returns
+ * false if the cache does not know.  Otherwise returns true and sets
+ * *SECTOR to the file's inode sector, or to DENTRY_NEGATIVE if NAME
+ * does not exist, and *IS_DIR to whether the file is a directory. */
+bool
+dentry_lookup (disk_sector_t parent, const char *name,
+		disk_sector_t *sector, bool *is_dir) {
+	struct dentry *d;
+
+	if (strlen (name) > NAME_MAX)
+		return false;
+
+	lock_acquire (&dentry_lock);
+	d = dentry_find (parent, name);
+	if (d != NULL) {
+		*sector = d->sector;
+		*is_dir = d->is_dir;
+		list_remove (&d->lru_elem);
+		list_push_front (&lru_list, &d->lru_elem);
+		hit_cnt++;
+		if (d->sector == DENTRY_NEGATIVE)
+			negative_hit_cnt++;
+	} else
+		miss_cnt++;
+	lock_release (&dentry_lock);
+
+	return d != NULL;
+}
+
+/* Records that NAME in the directory whose inode is at PARENT has its
+ * inode at SECTOR, or does not exist if SECTOR is DENTRY_NEGATIVE.
+ * IS_DIR tells whether it is a directory. */
+void
+dentry_insert (disk_sector_t parent, const char *name,
+		disk_sector_t sector, bool is_dir) {
+	struct dentry *d;
+
+	if (strlen (name) > NAME_MAX)
+		return;
+
+	lock_acquire (&dentry_lock);
+	d = dentry_find (parent, name);
+	if (d == NULL) {
+		/* Reuse the least recently used entry. */
+		d = list_entry (list_back (&lru_list), struct dentry, lru_elem);
+		if (d->in_use)
+			hash_delete (&dentries, &d->hash_elem);
+		d->parent = parent;
+		strlcpy (d->name, name, sizeof d->name);
+		d->in_use = true;
+		hash_insert (&dentries, &d->hash_elem);
+	}
+	d->sector = sector;
+	d->is_dir = is_dir;
+	list_remove (&d->lru_elem);
+	list_push_front (&lru_list, &d->lru_elem);
+	lock_release (&dentry_lock);
+}
+
+/* Forgets whatever is cached for NAME in the directory whose inode is
+ * at PARENT. */
+void
+dentry_invalidate (disk_sector_t parent, const char *name) {
+	struct dentry *d;
+
+	if (strlen (name) > NAME_MAX)
+		return;
+
+	lock_acquire (&dentry_lock);
+	d = dentry_find (parent, name);
+	if (d != NULL) {
+		hash_delete (&dentries, &d->hash_elem);
+		d->in_use = false;
+		list_remove (&d->lru_elem);
+		list_push_back (&lru_list, &d->lru_elem);
+	}
+	lock_release (&dentry_lock);
+}
+
+/* Prints dentry cache statistics. */
+void
+dentry_print_stats (void) {
+	printf ("Dentry cache: %lld hits (%lld negative), %lld misses\n",
+			hit_cnt, negative_hit_cnt, miss_cnt);
+}
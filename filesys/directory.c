@@ -1,7 +1,9 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include "filesys/dentry.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
@@ -19,11 +21,30 @@ struct dir_entry {
 	bool in_use;                        /* In use or free? */
 };
 
+/* In-memory index of a directory's entries, so that looking up a
+ * name and finding a free entry take O(1) instead of a read of every
+ * entry.  Built on first use and attached to the directory's inode,
+ * so every struct dir on the inode shares it; kept up to date by
+ * dir_add() and dir_remove(), and freed when the inode is closed. */
+struct dir_index {
+	struct hash names;                  /* Slots in use, by name. */
+	struct list free_slots;             /* Slots not in use. */
+};
+
+/* One entry of the directory file. */
+struct dir_slot {
+	struct hash_elem hash_elem;         /* In NAMES, if in use. */
+	struct list_elem list_elem;         /* In FREE_SLOTS, if not. */
+	off_t ofs;                          /* Byte offset of the entry. */
+	disk_sector_t inode_sector;         /* Sector number of header. */
+	char name[NAME_MAX + 1];            /* Null terminated file name. */
+};
+
 /* Creates a directory with space for ENTRY_CNT entries in the
  * given SECTOR.  Returns true if successful, false on failure. */
 bool
 dir_create (disk_sector_t sector, size_t entry_cnt) {
-	return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+	return inode_create (sector, entry_cnt * sizeof (struct dir_entry), true);
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -71,6 +92,88 @@ dir_get_inode (struct dir *dir) {
 	return dir->inode;
 }
 
+static uint64_t
+dir_slot_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_string (hash_entry (e, struct dir_slot, hash_elem)->name);
+}
+
+static bool
+dir_slot_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return strcmp (hash_entry (a, struct dir_slot, hash_elem)->name,
+			hash_entry (b, struct dir_slot, hash_elem)->name) < 0;
+}
+
+static void
+dir_slot_free (struct hash_elem *e, void *aux UNUSED) {
+	free (hash_entry (e, struct dir_slot, hash_elem));
+}
+
+/* Frees INDEX.  Called when the directory's inode is closed. */
+static void
+dir_index_destroy (void *index_) {
+	struct dir_index *index = index_;
+
+	while (!list_empty (&index->free_slots))
+		free (list_entry (list_pop_front (&index->free_slots),
+					struct dir_slot, list_elem));
+	hash_destroy (&index->names, dir_slot_free);
+	free (index);
+}
+
+/* Returns DIR's index, reading every entry of DIR to build it if it
+ * does not exist yet.  Returns a null pointer if memory runs out, in
+ * which case callers fall back to scanning the entries. */
+static struct dir_index *
+dir_index_get (const struct dir *dir) {
+	struct dir_index *index = inode_get_aux (dir->inode);
+	struct dir_slot *slot;
+	struct dir_entry e;
+	off_t ofs;
+
+	if (index != NULL)
+		return index;
+
+	index = malloc (sizeof *index);
+	if (index == NULL)
+		return NULL;
+	if (!hash_init (&index->names, dir_slot_hash, dir_slot_less, NULL)) {
+		free (index);
+		return NULL;
+	}
+	list_init (&index->free_slots);
+
+	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+			ofs += sizeof e) {
+		slot = malloc (sizeof *slot);
+		if (slot == NULL) {
+			dir_index_destroy (index);
+			return NULL;
+		}
+		slot->ofs = ofs;
+		slot->inode_sector = e.inode_sector;
+		strlcpy (slot->name, e.name, sizeof slot->name);
+		if (e.in_use)
+			hash_insert (&index->names, &slot->hash_elem);
+		else
+			list_push_back (&index->free_slots, &slot->list_elem);
+	}
+
+	inode_set_aux (dir->inode, index, dir_index_destroy);
+	return index;
+}
+
+/* Returns the slot in INDEX for NAME, or a null pointer. */
+static struct dir_slot *
+dir_index_find (struct dir_index *index, const char *name) {
+	struct dir_slot key;
+	struct hash_elem *e;
+
+	strlcpy (key.name, name, sizeof key.name);
+	e = hash_find (&index->names, &key.hash_elem);
+	return e != NULL ? hash_entry (e, struct dir_slot, hash_elem) : NULL;
+}
+
 /* Searches DIR for a file with the given NAME.
  * If successful, returns true, sets *EP to the directory entry
  * if EP is non-null, and sets *OFSP to the byte offset of the
@@ -79,12 +182,32 @@ dir_get_inode (struct dir *dir) {
 static bool
 lookup (const struct dir *dir, const char *name,
 		struct dir_entry *ep, off_t *ofsp) {
+	struct dir_index *index;
+	struct dir_slot *slot;
 	struct dir_entry e;
 	size_t ofs;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
+	index = dir_index_get (dir);
+	if (index != NULL) {
+		/* A name longer than NAME_MAX can never be in DIR. */
+		if (strlen (name) > NAME_MAX)
+			return false;
+		slot = dir_index_find (index, name);
+		if (slot == NULL)
+			return false;
+		if (ep != NULL) {
+			ep->inode_sector = slot->inode_sector;
+			strlcpy (ep->name, slot->name, sizeof ep->name);
+			ep->in_use = true;
+		}
+		if (ofsp != NULL)
+			*ofsp = slot->ofs;
+		return true;
+	}
+
 	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 			ofs += sizeof e)
 		if (e.in_use && !strcmp (name, e.name)) {
@@ -100,19 +223,35 @@ lookup (const struct dir *dir, const char *name,
 /* Searches DIR for a file with the given NAME
  * and returns true if one exists, false otherwise.
  * On success, sets *INODE to an inode for the file, otherwise to
- * a null pointer.  The caller must close *INODE. */
+ * a null pointer.  The caller must close *INODE.
+ * While DIR is locked the dentry cache agrees with it, so a cached
+ * answer is used without searching DIR.  Otherwise the answer goes
+ * into the dentry cache while DIR is still locked, so that it cannot
+ * overtake a concurrent dir_add() or dir_remove(). */
 bool
 dir_lookup (const struct dir *dir, const char *name,
 		struct inode **inode) {
+	disk_sector_t parent, sector;
 	struct dir_entry e;
+	bool is_dir;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
-	if (lookup (dir, name, &e, NULL))
+	parent = inode_get_inumber (dir->inode);
+	inode_lock_dir (dir->inode);
+	if (dentry_lookup (parent, name, &sector, &is_dir))
+		*inode = sector != DENTRY_NEGATIVE ? inode_open (sector) : NULL;
+	else if (lookup (dir, name, &e, NULL)) {
 		*inode = inode_open (e.inode_sector);
-	else
+		if (*inode != NULL)
+			dentry_insert (parent, name, e.inode_sector,
+					inode_is_dir (*inode));
+	} else {
 		*inode = NULL;
+		dentry_insert (parent, name, DENTRY_NEGATIVE, false);
+	}
+	inode_unlock_dir (dir->inode);
 
 	return *inode != NULL;
 }
@@ -125,6 +264,8 @@ dir_lookup (const struct dir *dir, const char *name,
  * error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
+	struct dir_index *index;
+	struct dir_slot *slot = NULL;
 	struct dir_entry e;
 	off_t ofs;
 	bool success = false;
@@ -136,21 +277,37 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
 	if (*name == '\0' || strlen (name) > NAME_MAX)
 		return false;
 
+	inode_lock_dir (dir->inode);
+
 	/* Check that NAME is not in use. */
 	if (lookup (dir, name, NULL, NULL))
 		goto done;
 
 	/* Set OFS to offset of free slot.
 	 * If there are no free slots, then it will be set to the
-	 * current end-of-file.
-
-	 * inode_read_at() will only return a short read at end of file.
-	 * Otherwise, we'd need to verify that we didn't get a short
-	 * read due to something intermittent such as low memory. */
-	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-			ofs += sizeof e)
-		if (!e.in_use)
-			break;
+	 * current end-of-file. */
+	index = dir_index_get (dir);
+	if (index != NULL) {
+		if (!list_empty (&index->free_slots))
+			slot = list_entry (list_front (&index->free_slots),
+					struct dir_slot, list_elem);
+		else {
+			slot = malloc (sizeof *slot);
+			if (slot == NULL)
+				goto done;
+			slot->ofs = inode_length (dir->inode);
+			list_push_front (&index->free_slots, &slot->list_elem);
+		}
+		ofs = slot->ofs;
+	} else {
+		/* inode_read_at() will only return a short read at end of file.
+		 * Otherwise, we'd need to verify that we didn't get a short
+		 * read due to something intermittent such as low memory. */
+		for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+				ofs += sizeof e)
+			if (!e.in_use)
+				break;
+	}
 
 	/* Write slot. */
 	e.in_use = true;
@@ -158,7 +315,17 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
 	e.inode_sector = inode_sector;
 	success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 
+	if (success)
+		dentry_invalidate (inode_get_inumber (dir->inode), name);
+	if (success && slot != NULL) {
+		list_remove (&slot->list_elem);
+		slot->inode_sector = inode_sector;
+		strlcpy (slot->name, name, sizeof slot->name);
+		hash_insert (&index->names, &slot->hash_elem);
+	}
+
 done:
+	inode_unlock_dir (dir->inode);
 	return success;
 }
 
@@ -167,6 +334,8 @@ done:
  * which occurs only if there is no file with the given NAME. */
 bool
 dir_remove (struct dir *dir, const char *name) {
+	struct dir_index *index;
+	struct dir_slot *slot;
 	struct dir_entry e;
 	struct inode *inode = NULL;
 	bool success = false;
@@ -175,6 +344,8 @@ dir_remove (struct dir *dir, const char *name) {
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
+	inode_lock_dir (dir->inode);
+
 	/* Find directory entry. */
 	if (!lookup (dir, name, &e, &ofs))
 		goto done;
@@ -189,11 +360,22 @@ dir_remove (struct dir *dir, const char *name) {
 	if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
 		goto done;
 
+	index = inode_get_aux (dir->inode);
+	if (index != NULL) {
+		slot = dir_index_find (index, name);
+		hash_delete (&index->names, &slot->hash_elem);
+		list_push_front (&index->free_slots, &slot->list_elem);
+	}
+
+	dentry_insert (inode_get_inumber (dir->inode), name, DENTRY_NEGATIVE,
+			false);
+
 	/* Remove inode. */
 	inode_remove (inode);
 	success = true;
 
 done:
+	inode_unlock_dir (dir->inode);
 	inode_close (inode);
 	return success;
 }
@@ -204,13 +386,17 @@ done:
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1]) {
 	struct dir_entry e;
+	bool found = false;
 
+	inode_lock_dir (dir->inode);
 	while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) {
 		dir->pos += sizeof e;
 		if (e.in_use) {
 			strlcpy (name, e.name, NAME_MAX + 1);
-			return true;
+			found = true;
+			break;
 		}
 	}
-	return false;
+	inode_unlock_dir (dir->inode);
+	return found;
 }
@@ -1,5 +1,7 @@
 #include "filesys/fat.h"
+#include <bitmap.h>
 #include "devices/disk.h"
+#include "filesys/buffer-cache.h"
 #include "filesys/filesys.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
@@ -22,14 +24,18 @@ struct fat_fs {
 	unsigned int *fat;
 	unsigned int fat_length;
 	disk_sector_t data_start;
-	cluster_t last_clst;
-	struct lock write_lock;
+	cluster_t last_clst;        /* Last cluster allocated. */
+	struct bitmap *free_map;    /* Clusters in use, one bit each. */
+	struct lock write_lock;     /* Protects FAT, FREE_MAP and LAST_CLST. */
 };
 
 static struct fat_fs *fat_fs;
 
 void fat_boot_create (void);
 void fat_fs_init (void);
+static void fat_free_map_build (void);
+static cluster_t fat_alloc_run (size_t cnt);
+static void fat_link_run (cluster_t clst, cluster_t first, size_t cnt);
 
 void
 fat_init (void) {
@@ -53,6 +59,8 @@ fat_init (void) {
 
 void
 fat_open (void) {
+	/* Formatting leaves the table it created behind. */
+	free (fat_fs->fat);
 	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
 	if (fat_fs->fat == NULL)
 		PANIC ("FAT load failed");
@@ -78,6 +86,8 @@ fat_open (void) {
 			free (bounce);
 		}
 	}
+
+	fat_free_map_build ();
 }
 
 void
@@ -123,6 +133,7 @@ fat_create (void) {
 	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
 	if (fat_fs->fat == NULL)
 		PANIC ("FAT creation failed");
+	fat_free_map_build ();
 
 	// Set up ROOT_DIR_CLST
 	fat_put (ROOT_DIR_CLUSTER, EOChain);
@@ -131,7 +142,8 @@ fat_create (void) {
 	uint8_t *buf = calloc (1, DISK_SECTOR_SIZE);
 	if (buf == NULL)
 		PANIC ("FAT create failed due to OOM");
-	disk_write (filesys_disk, cluster_to_sector (ROOT_DIR_CLUSTER), buf);
+	buffer_cache_write (cluster_to_sector (ROOT_DIR_CLUSTER), buf, 0,
+			DISK_SECTOR_SIZE);
 	free (buf);
 }
 
@@ -152,7 +164,68 @@ fat_boot_create (void) {
 
 void
 fat_fs_init (void) {
-	/* TODO: Your code goes here. */
+	/* Cluster 0 means "no cluster", so cluster 1 is the first cluster
+	 * of the data area right after the FAT.  The FAT has an entry for
+	 * every cluster that fits on the disk, up to what its sectors
+	 * hold. */
+	unsigned int data_clusters;
+	unsigned int fat_entries;
+
+	fat_fs->data_start = fat_fs->bs.fat_start + fat_fs->bs.fat_sectors;
+	data_clusters = (fat_fs->bs.total_sectors - fat_fs->data_start)
+		/ SECTORS_PER_CLUSTER;
+	fat_entries = fat_fs->bs.fat_sectors * (DISK_SECTOR_SIZE / sizeof (cluster_t));
+	fat_fs->fat_length = data_clusters + 1 < fat_entries
+		? data_clusters + 1 : fat_entries;
+	fat_fs->last_clst = ROOT_DIR_CLUSTER;
+	lock_init (&fat_fs->write_lock);
+}
+
+/* Builds FREE_MAP from the FAT with one pass over it, so that
+ * allocation never has to scan the FAT itself. */
+static void
+fat_free_map_build (void) {
+	if (fat_fs->free_map != NULL)
+		bitmap_destroy (fat_fs->free_map);
+	fat_fs->free_map = bitmap_create (fat_fs->fat_length);
+	if (fat_fs->free_map == NULL)
+		PANIC ("FAT free map creation failed");
+
+	bitmap_mark (fat_fs->free_map, 0);
+	for (cluster_t clst = 1; clst < fat_fs->fat_length; clst++)
+		if (fat_fs->fat[clst] != 0)
+			bitmap_mark (fat_fs->free_map, clst);
+}
+
+/* Marks CNT consecutive free clusters used and returns the first, or
+ * 0 if no run that long is free.  Next-fit: the search starts after
+ * the last cluster allocated, so a growing file takes consecutive
+ * clusters without rescanning the used ones.  WRITE_LOCK must be
+ * held. */
+static cluster_t
+fat_alloc_run (size_t cnt) {
+	size_t clst;
+
+	clst = bitmap_scan_and_flip (fat_fs->free_map, fat_fs->last_clst + 1, cnt, false);
+	if (clst == BITMAP_ERROR)
+		clst = bitmap_scan_and_flip (fat_fs->free_map, 1, cnt, false);
+	if (clst == BITMAP_ERROR)
+		return 0;
+
+	fat_fs->last_clst = clst + cnt - 1;
+	return clst;
+}
+
+/* Chains the CNT clusters starting at FIRST in order, ends the chain
+ * after them, and links them after CLST unless it is 0.  WRITE_LOCK
+ * must be held. */
+static void
+fat_link_run (cluster_t clst, cluster_t first, size_t cnt) {
+	for (size_t i = 0; i + 1 < cnt; i++)
+		fat_fs->fat[first + i] = first + i + 1;
+	fat_fs->fat[first + cnt - 1] = EOChain;
+	if (clst != 0)
+		fat_fs->fat[clst] = first;
 }
 
 /*----------------------------------------------------------------------------*/
@@ -164,30 +237,108 @@ fat_fs_init (void) {
  * Returns 0 if fails to allocate a new cluster. */
 cluster_t
 fat_create_chain (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	return fat_create_run (clst, 1);
+}
+
+/* Adds a run of CNT consecutive clusters to the chain after CLST, or
+ * starts a new chain with it if CLST is 0.
+ * Returns the first cluster of the run, or 0 if no run of CNT free
+ * clusters is left. */
+cluster_t
+fat_create_run (cluster_t clst, size_t cnt) {
+	cluster_t first;
+
+	ASSERT (clst < fat_fs->fat_length);
+	ASSERT (cnt > 0);
+
+	lock_acquire (&fat_fs->write_lock);
+	first = fat_alloc_run (cnt);
+	if (first != 0)
+		fat_link_run (clst, first, cnt);
+	lock_release (&fat_fs->write_lock);
+
+	return first;
+}
+
+/* Adds the CNT clusters right after CLST, the last cluster of a chain,
+ * to the chain if they are all free, so that it grows without a gap.
+ * Returns false if they are not. */
+bool
+fat_grow_chain (cluster_t clst, size_t cnt) {
+	bool success;
+
+	ASSERT (clst != 0 && clst < fat_fs->fat_length);
+	ASSERT (cnt > 0);
+
+	lock_acquire (&fat_fs->write_lock);
+	ASSERT (fat_fs->fat[clst] == EOChain);
+	success = clst + cnt < fat_fs->fat_length
+		&& bitmap_none (fat_fs->free_map, clst + 1, cnt);
+	if (success) {
+		bitmap_set_multiple (fat_fs->free_map, clst + 1, cnt, true);
+		fat_link_run (clst, clst + 1, cnt);
+		fat_fs->last_clst = clst + cnt;
+	}
+	lock_release (&fat_fs->write_lock);
+
+	return success;
 }
 
 /* Remove the chain of clusters starting from CLST.
  * If PCLST is 0, assume CLST as the start of the chain. */
 void
 fat_remove_chain (cluster_t clst, cluster_t pclst) {
-	/* TODO: Your code goes here. */
+	cluster_t next;
+
+	ASSERT (clst != 0 && clst < fat_fs->fat_length);
+
+	lock_acquire (&fat_fs->write_lock);
+	if (pclst != 0)
+		fat_fs->fat[pclst] = EOChain;
+
+	for (; clst != EOChain; clst = next) {
+		ASSERT (clst != 0 && clst < fat_fs->fat_length);
+		next = fat_fs->fat[clst];
+		fat_fs->fat[clst] = 0;
+		bitmap_reset (fat_fs->free_map, clst);
+	}
+	lock_release (&fat_fs->write_lock);
 }
 
 /* Update a value in the FAT table. */
 void
 fat_put (cluster_t clst, cluster_t val) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst != 0 && clst < fat_fs->fat_length);
+
+	lock_acquire (&fat_fs->write_lock);
+	fat_fs->fat[clst] = val;
+	bitmap_set (fat_fs->free_map, clst, val != 0);
+	lock_release (&fat_fs->write_lock);
 }
 
 /* Fetch a value in the FAT table. */
 cluster_t
 fat_get (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst != 0 && clst < fat_fs->fat_length);
+
+	return fat_fs->fat[clst];
 }
 
 /* Covert a cluster # to a sector number. */
 disk_sector_t
 cluster_to_sector (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst != 0 && clst < fat_fs->fat_length);
+
+	return fat_fs->data_start + (clst - 1) * SECTORS_PER_CLUSTER;
+}
+
+/* Convert a sector number in the data area to its cluster #. */
+cluster_t
+sector_to_cluster (disk_sector_t sector) {
+	cluster_t clst;
+
+	ASSERT (sector >= fat_fs->data_start);
+	clst = (sector - fat_fs->data_start) / SECTORS_PER_CLUSTER + 1;
+	ASSERT (clst < fat_fs->fat_length);
+	return clst;
 }
@@ -2,15 +2,24 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/buffer-cache.h"
+#include "filesys/dentry.h"
+#include "filesys/fat.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
 #include "devices/disk.h"
+#include "threads/thread.h"
 
 /* The disk that contains the file system. */
 struct disk *filesys_disk;
 
+/* The root directory's inode, held open while the file system is up
+ * so that the directory's in-memory index is not thrown away every
+ * time its last dir_close() happens. */
+static struct inode *root_inode;
+
 static void do_format (void);
 
 /* Initializes the file system module.
@@ -21,7 +30,10 @@ filesys_init (bool format) {
 	if (filesys_disk == NULL)
 		PANIC ("hd0:1 (hdb) not present, file system initialization failed");
 
+	buffer_cache_init ();
 	inode_init ();
+	file_init ();
+	dentry_init ();
 
 #ifdef EFILESYS
 	fat_init ();
@@ -39,18 +51,99 @@ filesys_init (bool format) {
 
 	free_map_open ();
 #endif
+
+	root_inode = inode_open (ROOT_DIR_SECTOR);
+	if (root_inode == NULL)
+		PANIC ("cannot open root directory");
 }
 
 /* Shuts down the file system module, writing any unwritten data
  * to disk. */
 void
 filesys_done (void) {
+	inode_close (root_inode);
+	root_inode = NULL;
+
 	/* Original FS */
 #ifdef EFILESYS
 	fat_close ();
 #else
 	free_map_close ();
 #endif
+	buffer_cache_flush ();
+}
+
+/* Looks up NAME in the directory whose inode is at PARENT, through
+ * the dentry cache.  On a miss, dir_lookup() reads the directory and
+ * caches the answer.  Returns the sector of the file's inode, or
+ * DENTRY_NEGATIVE if there is none, and sets *IS_DIR to whether the
+ * file is a directory. */
+static disk_sector_t
+lookup_name (disk_sector_t parent, const char *name, bool *is_dir) {
+	struct inode *inode = NULL;
+	disk_sector_t sector;
+	struct dir *dir;
+
+	if (dentry_lookup (parent, name, &sector, is_dir))
+		return sector;
+
+	*is_dir = false;
+	dir = dir_open (inode_open (parent));
+	if (dir == NULL)
+		return DENTRY_NEGATIVE;
+	dir_lookup (dir, name, &inode);
+	dir_close (dir);
+
+	sector = DENTRY_NEGATIVE;
+	if (inode != NULL) {
+		sector = inode_get_inumber (inode);
+		*is_dir = inode_is_dir (inode);
+		inode_close (inode);
+	}
+	return sector;
+}
+
+/* Resolves every component of PATH but the last, starting from the
+ * root directory if PATH is absolute and from the current thread's
+ * working directory otherwise.  Directories on the way are found in
+ * the dentry cache when possible, without being opened.
+ * On success, sets *PARENT to the inode sector of the directory that
+ * holds the last component, copies that component into NAME and
+ * returns true.  Fails if a component is missing, not a directory or
+ * too long, or if PATH has no last component. */
+static bool
+resolve_parent (const char *path, disk_sector_t *parent,
+		char name[NAME_MAX + 1]) {
+	struct inode *cwd = thread_current ()->cwd;
+	disk_sector_t dir;
+	bool is_dir;
+	size_t len;
+
+	if (*path == '/' || cwd == NULL)
+		dir = ROOT_DIR_SECTOR;
+	else
+		dir = inode_get_inumber (cwd);
+
+	for (;;) {
+		path += strspn (path, "/");
+		len = strcspn (path, "/");
+		if (len > NAME_MAX)
+			return false;
+		memcpy (name, path, len);
+		name[len] = '\0';
+
+		path += len;
+		path += strspn (path, "/");
+		if (*path == '\0')
+			break;
+
+		dir = lookup_name (dir, name, &is_dir);
+		if (dir == DENTRY_NEGATIVE || !is_dir)
+			return false;
+	}
+
+	*parent = dir;
+	return name[0] != '\0';
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -59,14 +152,21 @@ filesys_done (void) {
  * or if internal memory allocation fails. */
 bool
 filesys_create (const char *name, off_t initial_size) {
+	char file_name[NAME_MAX + 1];
+	disk_sector_t parent;
 	disk_sector_t inode_sector = 0;
-	struct dir *dir = dir_open_root ();
+	struct dir *dir;
+
+	if (!resolve_parent (name, &parent, file_name))
+		return false;
+
+	dir = dir_open (inode_open (parent));
 	bool success = (dir != NULL
-			&& free_map_allocate (1, &inode_sector)
-			&& inode_create (inode_sector, initial_size)
-			&& dir_add (dir, name, inode_sector));
+			&& inode_alloc_sector (&inode_sector)
+			&& inode_create (inode_sector, initial_size, false)
+			&& dir_add (dir, file_name, inode_sector));
 	if (!success && inode_sector != 0)
-		free_map_release (inode_sector, 1);
+		inode_free_sector (inode_sector);
 	dir_close (dir);
 
 	return success;
@@ -79,11 +179,27 @@ filesys_create (const char *name, off_t initial_size) {
  * or if an internal memory allocation fails. */
 struct file *
 filesys_open (const char *name) {
-	struct dir *dir = dir_open_root ();
+	char file_name[NAME_MAX + 1];
 	struct inode *inode = NULL;
-
+	disk_sector_t parent;
+	disk_sector_t sector;
+	struct dir *dir;
+	bool is_dir;
+
+	if (!resolve_parent (name, &parent, file_name))
+		return NULL;
+
+	/* A negative entry answers at once.  A positive one is not
+	 * enough: the file may be removed, and its sector freed, before
+	 * it is opened, so dir_lookup() takes it again under the
+	 * directory's lock, and then opens it without a search. */
+	if (dentry_lookup (parent, file_name, &sector, &is_dir)
+			&& sector == DENTRY_NEGATIVE)
+		return NULL;
+
+	dir = dir_open (inode_open (parent));
 	if (dir != NULL)
-		dir_lookup (dir, name, &inode);
+		dir_lookup (dir, file_name, &inode);
 	dir_close (dir);
 
 	return file_open (inode);
@@ -95,8 +211,15 @@ filesys_open (const char *name) {
  * or if an internal memory allocation fails. */
 bool
 filesys_remove (const char *name) {
-	struct dir *dir = dir_open_root ();
-	bool success = dir != NULL && dir_remove (dir, name);
+	char file_name[NAME_MAX + 1];
+	disk_sector_t parent;
+	struct dir *dir;
+
+	if (!resolve_parent (name, &parent, file_name))
+		return false;
+
+	dir = dir_open (inode_open (parent));
+	bool success = dir != NULL && dir_remove (dir, file_name);
 	dir_close (dir);
 
 	return success;
@@ -108,8 +231,11 @@ do_format (void) {
 	printf ("Formatting file system...");
 
 #ifdef EFILESYS
-	/* Create FAT and save it to the disk. */
+	/* Create FAT and save it to the disk.  fat_create() has set aside
+	 * ROOT_DIR_CLUSTER for the root directory's inode. */
 	fat_create ();
+	if (!dir_create (ROOT_DIR_SECTOR, 16))
+		PANIC ("root directory creation failed");
 	fat_close ();
 #else
 	free_map_create ();
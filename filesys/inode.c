@@ -1,22 +1,61 @@
 #include "filesys/inode.h"
 #include <list.h>
 #include <debug.h>
+#include <hash.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/buffer-cache.h"
+#include "filesys/fat.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of extents held in an on-disk inode. */
+#define INODE_EXTENTS 41
+
+/* Number of extents held in an extent block, and of extent blocks
+ * listed in an overflow index. */
+#define BLOCK_EXTENTS 42
+#define INDEX_BLOCKS (DISK_SECTOR_SIZE / sizeof (disk_sector_t))
+
+/* Most extents a file can have. */
+#define MAX_EXTENTS (INODE_EXTENTS + INDEX_BLOCKS * BLOCK_EXTENTS)
+
+/* Most sectors allocated ahead of a file growing at its end. */
+#define INODE_PREALLOC 32
+
+/* Buckets in the table of open inodes.  A power of 2. */
+#define OPEN_INODE_BUCKETS 64
+
+/* A run of contiguous sectors holding sectors OFS through OFS + CNT - 1
+ * of a file. */
+struct extent {
+	disk_sector_t start;                /* First disk sector. */
+	uint32_t ofs;                       /* First file sector held. */
+	uint32_t cnt;                       /* Number of sectors. */
+};
+
 /* On-disk inode.
- * Must be exactly DISK_SECTOR_SIZE bytes long. */
+ * Must be exactly DISK_SECTOR_SIZE bytes long.
+ * The data lives in EXTENT_CNT extents sorted by OFS, which together
+ * hold file sectors 0 through the end of the last extent.  The first
+ * INODE_EXTENTS are in the inode.  A file on a fragmented disk may
+ * need more: OVERFLOW is then an index sector that lists the extent
+ * blocks holding the rest, BLOCK_EXTENTS to a block.  Sectors past
+ * LENGTH may be allocated ahead for a growing file, and are given
+ * back when it is closed. */
 struct inode_disk {
-	disk_sector_t start;                /* First data sector. */
 	off_t length;                       /* File size in bytes. */
 	unsigned magic;                     /* Magic number. */
-	uint32_t unused[125];               /* Not used. */
+	uint32_t extent_cnt;                /* Extents in use. */
+	struct extent extents[INODE_EXTENTS]; /* Data sectors. */
+	uint32_t is_dir;                    /* Nonzero for a directory. */
+	disk_sector_t overflow;             /* Overflow index, or 0 if none. */
 };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -26,72 +65,493 @@ bytes_to_sectors (off_t size) {
 	return DIV_ROUND_UP (size, DISK_SECTOR_SIZE);
 }
 
-/* In-memory inode. */
+/* In-memory inode.
+ *
+ * DATA is guarded by RWLOCK.  Reads, and writes that stay inside the
+ * file, hold it for reading: they only look up sectors, and the
+ * buffer cache keeps each sector access atomic.  A write that extends
+ * the file changes the extents and the length, so it holds RWLOCK for
+ * writing.  Neither ever touches user memory: callers hand them
+ * kernel buffers, so a page fault, which may read a file of its own,
+ * never happens with RWLOCK or a buffer cache lock held. */
 struct inode {
-	struct list_elem elem;              /* Element in inode list. */
+	struct list_elem elem;              /* Element in its bucket. */
 	disk_sector_t sector;               /* Sector number of disk location. */
 	int open_cnt;                       /* Number of openers. */
+	bool loading;                       /* DATA being read by inode_open()? */
 	bool removed;                       /* True if deleted, false otherwise. */
+	struct lock lock;                   /* Protects DENY_WRITE_CNT. */
 	int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+	struct rwlock rwlock;               /* Guards DATA. */
+	struct lock dir_lock;               /* Serializes directory operations. */
 	struct inode_disk data;             /* Inode content. */
+	void *aux;                          /* Kept by another module. */
+	void (*aux_destroy) (void *);       /* Frees AUX on last close. */
 };
 
+/* Returns the number of extent blocks that hold the extents past
+ * the first INODE_EXTENTS of CNT. */
+static size_t
+extent_blocks (size_t cnt) {
+	return cnt > INODE_EXTENTS
+		? DIV_ROUND_UP (cnt - INODE_EXTENTS, BLOCK_EXTENTS) : 0;
+}
+
+/* Returns the sector of extent block B of DISK_INODE, or 0 if it has
+ * none. */
+static disk_sector_t
+extent_block (const struct inode_disk *disk_inode, size_t b) {
+	disk_sector_t sector = 0;
+
+	if (disk_inode->overflow != 0)
+		buffer_cache_read (disk_inode->overflow, &sector, b * sizeof sector,
+				sizeof sector);
+	return sector;
+}
+
+/* Reads extent I of DISK_INODE into *E. */
+static void
+extent_get (const struct inode_disk *disk_inode, size_t i, struct extent *e) {
+	if (i < INODE_EXTENTS) {
+		*e = disk_inode->extents[i];
+		return;
+	}
+	i -= INODE_EXTENTS;
+	buffer_cache_read (extent_block (disk_inode, i / BLOCK_EXTENTS), e,
+			i % BLOCK_EXTENTS * sizeof *e, sizeof *e);
+}
+
+/* Stores *E as extent I of DISK_INODE.  An extent past the inode goes
+ * into its extent block, which extent_reserve() allocated, at once;
+ * the caller writes back the inode itself. */
+static void
+extent_put (struct inode_disk *disk_inode, size_t i, const struct extent *e) {
+	if (i < INODE_EXTENTS) {
+		disk_inode->extents[i] = *e;
+		return;
+	}
+	i -= INODE_EXTENTS;
+	buffer_cache_write (extent_block (disk_inode, i / BLOCK_EXTENTS), e,
+			i % BLOCK_EXTENTS * sizeof *e, sizeof *e);
+}
+
+/* Makes room in DISK_INODE for extent I, allocating the overflow index
+ * and an extent block if it needs them.  Returns false if the disk is
+ * full or I is not below MAX_EXTENTS. */
+static bool
+extent_reserve (struct inode_disk *disk_inode, size_t i) {
+	static const disk_sector_t no_blocks[INDEX_BLOCKS];
+	disk_sector_t sector;
+	size_t b;
+
+	if (i < INODE_EXTENTS)
+		return true;
+	if (i >= MAX_EXTENTS)
+		return false;
+
+	if (disk_inode->overflow == 0) {
+		if (!inode_alloc_sector (&sector))
+			return false;
+		buffer_cache_write (sector, no_blocks, 0, DISK_SECTOR_SIZE);
+		disk_inode->overflow = sector;
+	}
+
+	b = (i - INODE_EXTENTS) / BLOCK_EXTENTS;
+	if (extent_block (disk_inode, b) != 0)
+		return true;
+	if (!inode_alloc_sector (&sector))
+		return false;
+	buffer_cache_write (disk_inode->overflow, &sector, b * sizeof sector,
+			sizeof sector);
+	return true;
+}
+
+/* Frees the extent blocks of DISK_INODE that no longer hold any of
+ * its first CNT extents, and the overflow index if it is no longer
+ * needed.  Extent blocks are allocated in order, so the first one
+ * missing from the index ends the list. */
+static void
+extent_shrink (struct inode_disk *disk_inode, size_t cnt) {
+	static const disk_sector_t none;
+	disk_sector_t sector;
+
+	if (disk_inode->overflow == 0)
+		return;
+
+	for (size_t b = extent_blocks (cnt); b < INDEX_BLOCKS
+			&& (sector = extent_block (disk_inode, b)) != 0; b++) {
+		inode_free_sector (sector);
+		buffer_cache_write (disk_inode->overflow, &none, b * sizeof none,
+				sizeof none);
+	}
+	if (cnt <= INODE_EXTENTS) {
+		inode_free_sector (disk_inode->overflow);
+		disk_inode->overflow = 0;
+	}
+}
+
+/* Returns the number of file sectors DISK_INODE has allocated. */
+static size_t
+allocated_sectors (const struct inode_disk *disk_inode) {
+	struct extent last;
+
+	if (disk_inode->extent_cnt == 0)
+		return 0;
+	extent_get (disk_inode, disk_inode->extent_cnt - 1, &last);
+	return last.ofs + last.cnt;
+}
+
+/* Reads into *E the extent of DISK_INODE that holds file sector OFS,
+ * which must be allocated.  Binary search over the extents. */
+static void
+sector_to_extent (const struct inode_disk *disk_inode, uint32_t ofs,
+		struct extent *e) {
+	struct extent mid_extent;
+	size_t lo, hi, mid;
+
+	lo = 0;
+	hi = disk_inode->extent_cnt;
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		extent_get (disk_inode, mid, &mid_extent);
+		if (mid_extent.ofs <= ofs)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	extent_get (disk_inode, lo, e);
+	ASSERT (ofs - e->ofs < e->cnt);
+}
+
 /* Returns the disk sector that contains byte offset POS within
  * INODE.
  * Returns -1 if INODE does not contain data for a byte at offset
  * POS. */
 static disk_sector_t
 byte_to_sector (const struct inode *inode, off_t pos) {
+	struct extent e;
+	uint32_t ofs;
+
 	ASSERT (inode != NULL);
-	if (pos < inode->data.length)
-		return inode->data.start + pos / DISK_SECTOR_SIZE;
-	else
+	if (pos >= inode->data.length)
 		return -1;
+
+	ofs = pos / DISK_SECTOR_SIZE;
+	sector_to_extent (&inode->data, ofs, &e);
+	return e.start + (ofs - e.ofs);
+}
+
+/* Returns how many sectors of INODE, starting with the one that
+ * contains byte offset POS, lie consecutively on disk inside the
+ * file.  Returns 0 if POS is past the end of INODE. */
+static size_t
+byte_to_run (const struct inode *inode, off_t pos) {
+	struct extent e;
+	size_t in_extent, in_file;
+	uint32_t ofs;
+
+	if (pos >= inode->data.length)
+		return 0;
+
+	ofs = pos / DISK_SECTOR_SIZE;
+	sector_to_extent (&inode->data, ofs, &e);
+	in_extent = e.ofs + e.cnt - ofs;
+	in_file = bytes_to_sectors (inode->data.length) - ofs;
+	return in_extent < in_file ? in_extent : in_file;
+}
+
+/* Allocates the CNT sectors right after LAST, the last extent of a
+ * file, if they are all free.
+ * Under the FAT file system a file's sectors form one cluster chain in
+ * file order, and its extents index the runs of consecutive clusters
+ * in it; SECTORS_PER_CLUSTER is 1, so a cluster is a sector. */
+static bool
+sectors_allocate_after (const struct extent *last, size_t cnt) {
+#ifdef EFILESYS
+	return fat_grow_chain (sector_to_cluster (last->start + last->cnt - 1),
+			cnt);
+#else
+	return free_map_allocate_at (last->start + last->cnt, cnt);
+#endif
+}
+
+/* Allocates CNT consecutive sectors to follow LAST, the last extent of
+ * a file or a null pointer if it has none, and stores the first into
+ * *START.  Returns false if no run of CNT sectors is free. */
+static bool
+sectors_allocate (const struct extent *last UNUSED, size_t cnt,
+		disk_sector_t *start) {
+#ifdef EFILESYS
+	cluster_t tail = last != NULL
+		? sector_to_cluster (last->start + last->cnt - 1) : 0;
+	cluster_t clst = fat_create_run (tail, cnt);
+
+	if (clst == 0)
+		return false;
+	*start = cluster_to_sector (clst);
+	return true;
+#else
+	return free_map_allocate (cnt, start);
+#endif
 }
 
-/* List of open inodes, so that opening a single inode twice
- * returns the same `struct inode'. */
-static struct list open_inodes;
+/* Adds up to CNT sectors to the end of DISK_INODE's data, extending
+ * the last extent in place if the sectors after it are free, and
+ * trying smaller runs if no run of CNT is.  On a fragmented disk the
+ * new extents spill over into extent blocks.
+ * Returns the number of sectors added, 0 if none could be. */
+static size_t
+extent_append (struct inode_disk *disk_inode, size_t cnt) {
+	size_t i = disk_inode->extent_cnt;
+	struct extent last;
+	uint32_t ofs = allocated_sectors (disk_inode);
+	disk_sector_t start;
+	bool room;
+
+	if (i > 0)
+		extent_get (disk_inode, i - 1, &last);
+	room = extent_reserve (disk_inode, i);
+
+	for (; cnt > 0; cnt /= 2) {
+		if (i > 0 && sectors_allocate_after (&last, cnt)) {
+			last.cnt += cnt;
+			extent_put (disk_inode, i - 1, &last);
+			return cnt;
+		}
+		if (room && sectors_allocate (i > 0 ? &last : NULL, cnt, &start)) {
+			extent_put (disk_inode, i, &(struct extent) {
+				.start = start,
+				.ofs = ofs,
+				.cnt = cnt,
+			});
+			disk_inode->extent_cnt++;
+			return cnt;
+		}
+	}
+	return 0;
+}
+
+/* Makes DISK_INODE hold at least SECTORS file sectors.  A file that
+ * grows at its end gets up to INODE_PREALLOC more sectors than it
+ * asked for, as many as it already has, so a sequential writer keeps
+ * extending one contiguous extent.
+ * Returns false if the disk or the extent table is full. */
+static bool
+inode_allocate (struct inode_disk *disk_inode, size_t sectors) {
+	size_t allocated = allocated_sectors (disk_inode);
+	size_t extra = allocated < INODE_PREALLOC ? allocated : INODE_PREALLOC;
+	size_t added;
+
+	while (allocated < sectors) {
+		added = extent_append (disk_inode, sectors - allocated + extra);
+		if (added == 0)
+			return false;
+		allocated += added;
+		extra = 0;
+	}
+	return true;
+}
+
+/* Frees DISK_INODE's sectors. */
+static void
+inode_release (struct inode_disk *disk_inode) {
+#ifdef EFILESYS
+	if (disk_inode->extent_cnt > 0)
+		fat_remove_chain (sector_to_cluster (disk_inode->extents[0].start), 0);
+#else
+	struct extent e;
+
+	for (size_t i = 0; i < disk_inode->extent_cnt; i++) {
+		extent_get (disk_inode, i, &e);
+		free_map_release (e.start, e.cnt);
+	}
+#endif
+	extent_shrink (disk_inode, 0);
+	disk_inode->extent_cnt = 0;
+}
+
+/* Gives back the sectors DISK_INODE has allocated past its first
+ * SECTORS, allocated ahead for a file that has stopped growing. */
+static void
+inode_trim (struct inode_disk *disk_inode, size_t sectors) {
+	size_t i = disk_inode->extent_cnt;
+	struct extent e;
+	size_t keep;
+
+	if (allocated_sectors (disk_inode) <= sectors)
+		return;
+
+#ifdef EFILESYS
+	/* The sectors to free are the tail of the file's cluster chain. */
+	{
+		cluster_t prev = 0;
+
+		if (sectors > 0) {
+			sector_to_extent (disk_inode, sectors - 1, &e);
+			prev = sector_to_cluster (e.start + (sectors - 1 - e.ofs));
+		}
+		sector_to_extent (disk_inode, sectors, &e);
+		fat_remove_chain (sector_to_cluster (e.start + (sectors - e.ofs)),
+				prev);
+	}
+#endif
+
+	while (i > 0) {
+		extent_get (disk_inode, i - 1, &e);
+		if (e.ofs + e.cnt <= sectors)
+			break;
+
+		keep = e.ofs < sectors ? sectors - e.ofs : 0;
+#ifndef EFILESYS
+		free_map_release (e.start + keep, e.cnt - keep);
+#endif
+		if (keep > 0) {
+			e.cnt = keep;
+			extent_put (disk_inode, i - 1, &e);
+			break;
+		}
+		i--;
+	}
+	disk_inode->extent_cnt = i;
+	extent_shrink (disk_inode, i);
+}
+
+/* Extends INODE to LENGTH bytes and writes its on-disk inode back.
+ * Sectors that now fall inside the file for the first time are filled
+ * with zeros, except those that bytes [SKIP_START, SKIP_END) are about
+ * to overwrite completely.  A sector that is only partly inside the
+ * file was zeroed when it was first reached, so its bytes past the old
+ * length are zeros already.
+ * Returns false if the disk or the extent table is full, leaving the
+ * length alone but recording whatever sectors were allocated. */
+static bool
+inode_grow (struct inode *inode, off_t length, off_t skip_start,
+		off_t skip_end) {
+	static char zeros[DISK_SECTOR_SIZE];
+	size_t old_sectors = bytes_to_sectors (inode->data.length);
+	size_t new_sectors = bytes_to_sectors (length);
+
+	if (!inode_allocate (&inode->data, new_sectors)) {
+		buffer_cache_write (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+		return false;
+	}
+	inode->data.length = length;
+
+	for (size_t i = old_sectors; i < new_sectors; i++) {
+		off_t sector_start = (off_t) i * DISK_SECTOR_SIZE;
+		if (skip_start <= sector_start
+				&& sector_start + DISK_SECTOR_SIZE <= skip_end)
+			continue;
+		buffer_cache_write (byte_to_sector (inode, sector_start), zeros, 0,
+				DISK_SECTOR_SIZE);
+	}
+
+	buffer_cache_write (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+	return true;
+}
+
+/* Open inodes, so that opening a single inode twice returns the same
+ * `struct inode'.  A hash table keyed on sector, chained through
+ * ELEM.  Each bucket has its own lock, which also protects the
+ * OPEN_CNT and LOADING of the inodes in it, so that opens and closes
+ * of different files seldom wait for each other.  The lock is not held
+ * while an inode is read from disk: the inode is in the bucket with
+ * LOADING set, and a concurrent open of it waits on LOADED. */
+struct inode_bucket {
+	struct list inodes;                 /* Open inodes. */
+	struct lock lock;                   /* Protects INODES and OPEN_CNTs. */
+	struct condition loaded;            /* Broadcast when an inode is read. */
+};
+
+static struct inode_bucket open_inodes[OPEN_INODE_BUCKETS];
+
+/* Returns the bucket that holds the inode at SECTOR. */
+static struct inode_bucket *
+inode_bucket (disk_sector_t sector) {
+	return &open_inodes[hash_int (sector) & (OPEN_INODE_BUCKETS - 1)];
+}
+
+/* Cache for in-memory inodes.  An inode is freed with its locks
+ * released, so they are initialized only when it is constructed. */
+static struct kmem_cache *inode_cache;
+
+/* Constructs the in-memory inode at INODE_. */
+static void
+inode_ctor (void *inode_) {
+	struct inode *inode = inode_;
+
+	lock_init (&inode->lock);
+	rwlock_init (&inode->rwlock);
+	lock_init (&inode->dir_lock);
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) {
-	list_init (&open_inodes);
+	inode_cache = kmem_cache_create ("inode", sizeof (struct inode),
+			inode_ctor);
+	for (size_t i = 0; i < OPEN_INODE_BUCKETS; i++) {
+		list_init (&open_inodes[i].inodes);
+		lock_init (&open_inodes[i].lock);
+		cond_init (&open_inodes[i].loaded);
+	}
 }
 
-/* Initializes an inode with LENGTH bytes of data and
- * writes the new inode to sector SECTOR on the file system
- * disk.
+/* Allocates a sector to hold a new inode and stores it into *SECTOR.
+ * Under the FAT file system it is a chain of its own.
+ * Returns false if the disk is full. */
+bool
+inode_alloc_sector (disk_sector_t *sector) {
+#ifdef EFILESYS
+	cluster_t clst = fat_create_chain (0);
+
+	if (clst == 0)
+		return false;
+	*sector = cluster_to_sector (clst);
+	return true;
+#else
+	return free_map_allocate (1, sector);
+#endif
+}
+
+/* Frees SECTOR, allocated by inode_alloc_sector(). */
+void
+inode_free_sector (disk_sector_t sector) {
+#ifdef EFILESYS
+	fat_remove_chain (sector_to_cluster (sector), 0);
+#else
+	free_map_release (sector, 1);
+#endif
+}
+
+/* Initializes an inode with LENGTH bytes of data, a directory if
+ * IS_DIR is true, and writes the new inode to sector SECTOR on the
+ * file system disk.
  * Returns true if successful.
  * Returns false if memory or disk allocation fails. */
 bool
-inode_create (disk_sector_t sector, off_t length) {
-	struct inode_disk *disk_inode = NULL;
+inode_create (disk_sector_t sector, off_t length, bool is_dir) {
+	struct inode *inode = NULL;
 	bool success = false;
 
 	ASSERT (length >= 0);
 
 	/* If this assertion fails, the inode structure is not exactly
 	 * one sector in size, and you should fix that. */
-	ASSERT (sizeof *disk_inode == DISK_SECTOR_SIZE);
-
-	disk_inode = calloc (1, sizeof *disk_inode);
-	if (disk_inode != NULL) {
-		size_t sectors = bytes_to_sectors (length);
-		disk_inode->length = length;
-		disk_inode->magic = INODE_MAGIC;
-		if (free_map_allocate (sectors, &disk_inode->start)) {
-			disk_write (filesys_disk, sector, disk_inode);
-			if (sectors > 0) {
-				static char zeros[DISK_SECTOR_SIZE];
-				size_t i;
-
-				for (i = 0; i < sectors; i++) 
-					disk_write (filesys_disk, disk_inode->start + i, zeros); 
-			}
-			success = true; 
-		} 
-		free (disk_inode);
+	ASSERT (sizeof inode->data == DISK_SECTOR_SIZE);
+
+	/* Build the inode in a scratch in-memory inode, so that growing it
+	 * to LENGTH goes through inode_grow() like any other write. */
+	inode = calloc (1, sizeof *inode);
+	if (inode != NULL) {
+		inode->sector = sector;
+		inode->data.magic = INODE_MAGIC;
+		inode->data.is_dir = is_dir;
+		success = inode_grow (inode, length, 0, 0);
+		if (!success)
+			inode_release (&inode->data);
+		free (inode);
 	}
 	return success;
 }
@@ -101,39 +561,63 @@ inode_create (disk_sector_t sector, off_t length) {
  * Returns a null pointer if memory allocation fails. */
 struct inode *
 inode_open (disk_sector_t sector) {
+	struct inode_bucket *b = inode_bucket (sector);
 	struct list_elem *e;
 	struct inode *inode;
 
+	lock_acquire (&b->lock);
+
 	/* Check whether this inode is already open. */
-	for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
+	for (e = list_begin (&b->inodes); e != list_end (&b->inodes);
 			e = list_next (e)) {
 		inode = list_entry (e, struct inode, elem);
 		if (inode->sector == sector) {
-			inode_reopen (inode);
-			return inode; 
+			inode->open_cnt++;
+			while (inode->loading)
+				cond_wait (&b->loaded, &b->lock);
+			lock_release (&b->lock);
+			return inode;
 		}
 	}
 
 	/* Allocate memory. */
-	inode = malloc (sizeof *inode);
-	if (inode == NULL)
+	inode = kmem_cache_alloc (inode_cache);
+	if (inode == NULL) {
+		lock_release (&b->lock);
 		return NULL;
+	}
 
-	/* Initialize. */
-	list_push_front (&open_inodes, &inode->elem);
+	/* Initialize.  A concurrent open of SECTOR waits until the inode
+	 * is read, but opens of other inodes in the bucket do not. */
+	list_push_front (&b->inodes, &inode->elem);
 	inode->sector = sector;
 	inode->open_cnt = 1;
+	inode->loading = true;
 	inode->deny_write_cnt = 0;
 	inode->removed = false;
-	disk_read (filesys_disk, inode->sector, &inode->data);
+	inode->aux = NULL;
+	inode->aux_destroy = NULL;
+	lock_release (&b->lock);
+
+	buffer_cache_read (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+
+	lock_acquire (&b->lock);
+	inode->loading = false;
+	cond_broadcast (&b->loaded, &b->lock);
+	lock_release (&b->lock);
 	return inode;
 }
 
 /* Reopens and returns INODE. */
 struct inode *
 inode_reopen (struct inode *inode) {
-	if (inode != NULL)
+	if (inode != NULL) {
+		struct inode_bucket *b = inode_bucket (inode->sector);
+
+		lock_acquire (&b->lock);
 		inode->open_cnt++;
+		lock_release (&b->lock);
+	}
 	return inode;
 }
 
@@ -152,19 +636,46 @@ inode_close (struct inode *inode) {
 	if (inode == NULL)
 		return;
 
-	/* Release resources if this was the last opener. */
-	if (--inode->open_cnt == 0) {
-		/* Remove from inode list and release lock. */
+	struct inode_bucket *b = inode_bucket (inode->sector);
+	bool last;
+
+	lock_acquire (&b->lock);
+
+	/* Give back the sectors allocated ahead before the last close.  A
+	 * concurrent open waits as it would for inode_open() to read the
+	 * inode, so that it never sees the sectors being freed. */
+	if (inode->open_cnt == 1 && !inode->removed
+			&& allocated_sectors (&inode->data)
+			> bytes_to_sectors (inode->data.length)) {
+		inode->loading = true;
+		lock_release (&b->lock);
+
+		inode_trim (&inode->data, bytes_to_sectors (inode->data.length));
+		buffer_cache_write (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+
+		lock_acquire (&b->lock);
+		inode->loading = false;
+		cond_broadcast (&b->loaded, &b->lock);
+	}
+
+	last = --inode->open_cnt == 0;
+	if (last)
 		list_remove (&inode->elem);
+	lock_release (&b->lock);
+
+	/* Release resources if this was the last opener.  INODE is out of
+	 * the table, so no one else can reach it. */
+	if (last) {
+		if (inode->aux_destroy != NULL)
+			inode->aux_destroy (inode->aux);
 
 		/* Deallocate blocks if removed. */
 		if (inode->removed) {
-			free_map_release (inode->sector, 1);
-			free_map_release (inode->data.start,
-					bytes_to_sectors (inode->data.length)); 
+			inode_free_sector (inode->sector);
+			inode_release (&inode->data);
 		}
 
-		free (inode); 
+		kmem_cache_free (inode_cache, inode);
 	}
 }
 
@@ -176,6 +687,21 @@ inode_remove (struct inode *inode) {
 	inode->removed = true;
 }
 
+/* Attaches AUX to INODE for as long as it stays open.  DESTROY, if
+ * non-null, is called on AUX when the last opener closes INODE. */
+void
+inode_set_aux (struct inode *inode, void *aux, void (*destroy) (void *)) {
+	inode->aux = aux;
+	inode->aux_destroy = destroy;
+}
+
+/* Returns the data attached to INODE with inode_set_aux(), or a null
+ * pointer. */
+void *
+inode_get_aux (const struct inode *inode) {
+	return inode->aux;
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
  * Returns the number of bytes actually read, which may be less
  * than SIZE if an error occurs or end of file is reached. */
@@ -183,7 +709,20 @@ off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 	uint8_t *buffer = buffer_;
 	off_t bytes_read = 0;
-	uint8_t *bounce = NULL;
+	disk_sector_t next_sector = (disk_sector_t) -1;
+	size_t span, run, next_run = 0;
+
+	ASSERT (size <= 0 || is_kernel_vaddr (buffer_));
+
+	rwlock_acquire_read (&inode->rwlock);
+
+	/* Bring in the sectors the read spans with one command, instead
+	 * of a miss for each. */
+	span = size > 0 ? bytes_to_sectors (offset % DISK_SECTOR_SIZE + size) : 0;
+	run = byte_to_run (inode, offset);
+	if (span > 1 && run > 1)
+		buffer_cache_prefetch (byte_to_sector (inode, offset),
+				span < run ? span : run);
 
 	while (size > 0) {
 		/* Disk sector to read, starting byte offset within sector. */
@@ -200,46 +739,59 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 		if (chunk_size <= 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Read full sector directly into caller's buffer. */
-			disk_read (filesys_disk, sector_idx, buffer + bytes_read); 
-		} else {
-			/* Read sector into bounce buffer, then partially copy
-			 * into caller's buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
-			disk_read (filesys_disk, sector_idx, bounce);
-			memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-		}
+		buffer_cache_read (sector_idx, buffer + bytes_read, sector_ofs,
+				chunk_size);
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_read += chunk_size;
 	}
-	free (bounce);
+
+	/* Start reading the sectors after the last one read, which a
+	 * sequential reader asks for next. */
+	if (bytes_read > 0) {
+		next_sector = byte_to_sector (inode,
+				ROUND_UP (offset, DISK_SECTOR_SIZE));
+		next_run = byte_to_run (inode, ROUND_UP (offset, DISK_SECTOR_SIZE));
+	}
+	rwlock_release_read (&inode->rwlock);
+	if (next_sector != (disk_sector_t) -1)
+		buffer_cache_readahead (next_sector, next_run);
 
 	return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+ * A write past end of file extends INODE; any gap between the old
+ * end and OFFSET reads as zeros.
  * Returns the number of bytes actually written, which may be
- * less than SIZE if end of file is reached or an error occurs.
- * (Normally a write at end of file would extend the inode, but
- * growth is not yet implemented.) */
+ * less than SIZE if the disk is full or an error occurs. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		off_t offset) {
 	const uint8_t *buffer = buffer_;
 	off_t bytes_written = 0;
-	uint8_t *bounce = NULL;
+	bool extend;
+
+	ASSERT (size <= 0 || is_kernel_vaddr (buffer_));
 
 	if (inode->deny_write_cnt)
 		return 0;
 
+	/* Extending INODE changes its extents, so no one else may look at
+	 * them meanwhile.  The data is written under the same exclusive
+	 * hold, so that no reader sees the new length before the data. */
+	extend = size > 0 && offset + size > inode_length (inode);
+	if (extend)
+		rwlock_acquire_write (&inode->rwlock);
+	else
+		rwlock_acquire_read (&inode->rwlock);
+
+	if (extend && offset + size > inode_length (inode)
+			&& !inode_grow (inode, offset + size, offset, offset + size))
+		size = 0;
+
 	while (size > 0) {
 		/* Sector to write, starting byte offset within sector. */
 		disk_sector_t sector_idx = byte_to_sector (inode, offset);
@@ -255,35 +807,19 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		if (chunk_size <= 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Write full sector directly to disk. */
-			disk_write (filesys_disk, sector_idx, buffer + bytes_written); 
-		} else {
-			/* We need a bounce buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
-
-			/* If the sector contains data before or after the chunk
-			   we're writing, then we need to read in the sector
-			   first.  Otherwise we start with a sector of all zeros. */
-			if (sector_ofs > 0 || chunk_size < sector_left) 
-				disk_read (filesys_disk, sector_idx, bounce);
-			else
-				memset (bounce, 0, DISK_SECTOR_SIZE);
-			memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-			disk_write (filesys_disk, sector_idx, bounce); 
-		}
+		buffer_cache_write (sector_idx, buffer + bytes_written, sector_ofs,
+				chunk_size);
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_written += chunk_size;
 	}
-	free (bounce);
 
+	if (extend)
+		rwlock_release_write (&inode->rwlock);
+	else
+		rwlock_release_read (&inode->rwlock);
 	return bytes_written;
 }
 
@@ -292,8 +828,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 	void
 inode_deny_write (struct inode *inode) 
 {
+	lock_acquire (&inode->lock);
 	inode->deny_write_cnt++;
 	ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+	lock_release (&inode->lock);
 }
 
 /* Re-enables writes to INODE.
@@ -301,9 +839,30 @@ inode_deny_write (struct inode *inode)
  * inode_deny_write() on the inode, before closing the inode. */
 void
 inode_allow_write (struct inode *inode) {
+	lock_acquire (&inode->lock);
 	ASSERT (inode->deny_write_cnt > 0);
 	ASSERT (inode->deny_write_cnt <= inode->open_cnt);
 	inode->deny_write_cnt--;
+	lock_release (&inode->lock);
+}
+
+/* Takes the lock that serializes operations on directory INODE.
+ * directory.c holds it across each lookup, add and remove. */
+void
+inode_lock_dir (struct inode *inode) {
+	lock_acquire (&inode->dir_lock);
+}
+
+/* Releases the lock taken by inode_lock_dir(). */
+void
+inode_unlock_dir (struct inode *inode) {
+	lock_release (&inode->dir_lock);
+}
+
+/* Returns true if INODE is a directory. */
+bool
+inode_is_dir (const struct inode *inode) {
+	return inode->data.is_dir != 0;
 }
 
 /* Returns the length, in bytes, of INODE's data. */
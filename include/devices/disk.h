@@ -2,6 +2,8 @@
 #define DEVICES_DISK_H
 
 #include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /* Size of a disk sector in bytes. */
@@ -15,6 +17,9 @@ typedef uint32_t disk_sector_t;
  * printf ("sector=%"PRDSNu"\n", sector); */
 #define PRDSNu PRIu32
 
+/* Set to false to turn off bus-master DMA. */
+extern bool disk_use_dma;
+
 void disk_init (void);
 void disk_print_stats (void);
 
@@ -22,6 +27,13 @@ struct disk *disk_get (int chan_no, int dev_no);
 disk_sector_t disk_size (struct disk *);
 void disk_read (struct disk *, disk_sector_t, void *);
 void disk_write (struct disk *, disk_sector_t, const void *);
+void disk_read_multiple (struct disk *, disk_sector_t, size_t cnt, void *);
+void disk_write_multiple (struct disk *, disk_sector_t, size_t cnt,
+		const void *);
+void disk_read_scatter (struct disk *, disk_sector_t, void *const buffers[],
+		size_t buffer_cnt, size_t buffer_sectors);
+void disk_write_gather (struct disk *, disk_sector_t, void *const buffers[],
+		size_t buffer_cnt, size_t buffer_sectors);
 
 void 	register_disk_inspect_intr ();
 #endif /* devices/disk.h */
@@ -18,6 +18,7 @@ void timer_msleep (int64_t milliseconds);
 void timer_usleep (int64_t microseconds);
 void timer_nsleep (int64_t nanoseconds);
 
+uint64_t timer_interrupt_cycles (void);
 void timer_print_stats (void);
 
 #endif /* devices/timer.h */
@@ -0,0 +1,17 @@
+#ifndef FILESYS_BUFFER_CACHE_H
+#define FILESYS_BUFFER_CACHE_H
+
+#include "devices/disk.h"
+
+/* Number of sectors held in the buffer cache. */
+#define BUFFER_CACHE_SIZE 64
+
+void buffer_cache_init (void);
+void buffer_cache_read (disk_sector_t, void *, int ofs, int size);
+void buffer_cache_write (disk_sector_t, const void *, int ofs, int size);
+void buffer_cache_readahead (disk_sector_t, size_t cnt);
+void buffer_cache_prefetch (disk_sector_t, size_t cnt);
+void buffer_cache_flush (void);
+void buffer_cache_print_stats (void);
+
+#endif /* filesys/buffer-cache.h */
@@ -0,0 +1,21 @@
+#ifndef FILESYS_DENTRY_H
+#define FILESYS_DENTRY_H
+
+#include <stdbool.h>
+#include "devices/disk.h"
+
+/* Sector of a cached name that does not exist: a negative entry. */
+#define DENTRY_NEGATIVE ((disk_sector_t) -1)
+
+/* Number of names the dentry cache holds. */
+#define DENTRY_CACHE_SIZE 256
+
+void dentry_init (void);
+bool dentry_lookup (disk_sector_t parent, const char *name,
+		disk_sector_t *sector, bool *is_dir);
+void dentry_insert (disk_sector_t parent, const char *name,
+		disk_sector_t sector, bool is_dir);
+void dentry_invalidate (disk_sector_t parent, const char *name);
+void dentry_print_stats (void);
+
+#endif /* filesys/dentry.h */
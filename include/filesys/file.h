@@ -15,6 +15,8 @@ struct file {
     int n_opened;               /* Number of file opened. */
 };
 
+void file_init (void);
+
 /* Opening and closing files. */
 struct file *file_open (struct inode *);
 struct file *file_reopen (struct file *);
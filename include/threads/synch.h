@@ -3,6 +3,7 @@
 
 #include <list.h>
 #include <stdbool.h>
+#include "threads/interrupt.h"
 
 /* A counting semaphore. */
 struct semaphore {
@@ -38,6 +39,59 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Reader-writer lock.  Any number of readers or one writer.
+   A waiting writer keeps new readers out; see synch.c. */
+struct rwlock {
+	struct lock lock;           /* Held by the writer, and by readers
+	                               while they enter. */
+	struct list readers;        /* rwlock_holds of the readers. */
+	bool writing;               /* Held by a writer? */
+	unsigned write_depth;       /* Writer's holds, reads included. */
+	struct thread *draining;    /* Writer waiting for readers to leave. */
+	struct semaphore drained;   /* Upped when the last reader leaves. */
+};
+
+/* Reader-writer locks a thread can hold for reading at once before
+   further ones are taken for writing instead.  The file system holds
+   one inode's at a time. */
+#define RWLOCK_HOLD_MAX 4
+
+/* A thread's read hold on a reader-writer lock. */
+struct rwlock_hold {
+	struct list_elem elem;      /* In the lock's READERS. */
+	struct rwlock *rwlock;      /* Lock held, or null if unused. */
+	struct thread *thread;      /* Thread holding it. */
+	unsigned depth;             /* Times taken, for nested reads. */
+};
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+bool rwlock_try_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+bool rwlock_try_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_held_for_read (const struct rwlock *);
+bool rwlock_held_for_write (const struct rwlock *);
+
+/* Spin lock.  Unlike a lock it never sleeps, so it may be taken
+   with interrupts off or in an interrupt handler, for critical
+   sections too short to be worth a context switch.  Holding one
+   keeps interrupts off on the holder's CPU, so that a handler there
+   cannot spin on it; on a single CPU it costs what intr_disable()
+   does.  Spin locks must be released in the reverse order of
+   acquisition. */
+struct spinlock {
+	volatile int locked;        /* Nonzero while held. */
+	struct cpu *holder;         /* CPU holding it (for debugging). */
+	enum intr_level old_level;  /* Interrupt level before acquisition. */
+};
+
+void spinlock_init (struct spinlock *);
+void spinlock_acquire (struct spinlock *);
+void spinlock_release (struct spinlock *);
+bool spinlock_held_by_current_cpu (const struct spinlock *);
+
 /* Optimization barrier.
  *
  * The compiler will not reorder operations across an
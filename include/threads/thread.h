@@ -9,6 +9,9 @@
 #ifdef VM
 #include "vm/vm.h"
 #endif
+#ifdef FILESYS
+struct inode;
+#endif
 
 
 /* States in a thread's life cycle. */
@@ -103,11 +106,13 @@ struct thread {
     struct lock* lock_on_waiting;       /* Pointer of lock that corresponding thread is waiting; For nested donation */
     struct list list_donated_threads;   /* List of donated threads to corresponding thread; For multiple donations */
     struct list_elem elem_for_donation; /* List element for donation */
+    struct rwlock_hold read_holds[RWLOCK_HOLD_MAX]; /* Reader-writer locks held for reading */
 
     int nice;                           /* Nice value of the corresponding thread */
 
     /* REAL NUMBER */
     int recent_cpu;                     /* Recent CPU value of the corresponding thread */
+    int64_t decayed_epoch;              /* Last decay epoch applied to recent_cpu */
 
     struct list_elem elem_for_pool;     /* List element for thread_pool */
 
@@ -132,6 +137,12 @@ struct thread {
 #ifdef USERPROG
 	/* Owned by userprog/process.c. */
 	uint64_t *pml4;                     /* Page map level 4 */
+	bool probing_user;                  /* In get_user() or put_user(). */
+#endif
+#ifdef FILESYS
+	/* Owned by filesys/filesys.c. */
+	struct inode *cwd;                  /* Working directory, held open;
+	                                       null for the root. */
 #endif
 #ifdef VM
 	/* Table for whole virtual memory owned by thread. */
@@ -147,6 +158,24 @@ struct thread {
 	unsigned magic;                     /* Detects stack overflow. */
 };
 
+/* Per-CPU state.  The kernel runs only on the boot CPU, cpus[0];
+   application processors, once brought up, would each get an entry
+   of their own, found through the LAPIC ID.  Interrupts must be off
+   while one is used, so that the thread cannot move to another CPU
+   meanwhile. */
+struct cpu {
+	struct thread *current;             /* Thread running on this CPU. */
+};
+
+#define CPU_MAX 1
+extern struct cpu cpus[CPU_MAX];
+
+/* Returns the state of the CPU that runs the caller. */
+static inline struct cpu *
+this_cpu (void) {
+	return &cpus[0];
+}
+
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
@@ -173,6 +202,7 @@ void thread_yield (void);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
+void thread_change_priority (struct thread *, int);
 
 int thread_get_nice (void);
 void thread_set_nice (int);
@@ -185,6 +215,11 @@ bool priority_less (const struct list_elem*, const struct list_elem*, void*);
 
 int calculate_priority (int recent_cpu, int nice);
 
+void mlfqs_increment_cpu (void);
+void mlfqs_load_avg (void);
+void mlfqs_recalculate_cpu (void);
+void mlfqs_recalculate_priority (void);
+
 /* Unlike `priority` and `recent_cpu`, `load_avg` is system-wide */
 int load_avg;
 
@@ -1,14 +1,17 @@
 #ifndef VM_ANON_H
 #define VM_ANON_H
 #include "vm/vm.h"
+#include "vm/swap.h"
 struct page;
+struct frame;
 enum vm_type;
 
 struct anon_page {
-    int swap_bit;
+    size_t swap_slot;           /* Swap slot, or SWAP_SLOT_NONE if resident. */
 };
 
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+size_t anon_swap_out_cluster (struct frame *frames[], size_t cnt);
 
 #endif
@@ -9,6 +9,8 @@ enum vm_type;
 struct file_page {
 };
 
+extern struct kmem_cache *file_aux_cache;
+
 void vm_file_init (void);
 bool file_backed_initializer (struct page *page, enum vm_type type, void *kva);
 void *do_mmap(void *addr, size_t length, int writable,
@@ -0,0 +1,19 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+#include <stddef.h>
+#include <stdint.h>
+
+/* A swap slot holds one page.  Slots are numbered from 0. */
+#define SWAP_SLOT_NONE SIZE_MAX
+
+/* Most pages written to swap in one request. */
+#define SWAP_CLUSTER 8
+
+void swap_init (void);
+size_t swap_slot_alloc (size_t cnt);
+void swap_slot_dup (size_t slot);
+void swap_slot_free (size_t slot, size_t cnt);
+void swap_read (size_t slot, void *kva);
+void swap_write (size_t slot, void *kvas[], size_t cnt);
+void swap_print_stats (void);
+#endif
@@ -1,6 +1,7 @@
 #ifndef VM_VM_H
 #define VM_VM_H
 #include <stdbool.h>
+#include <list.h>
 #include "threads/palloc.h"
 
 enum vm_type {
@@ -27,7 +28,6 @@ enum vm_type {
 #include "vm/uninit.h"
 #include "vm/anon.h"
 #include "vm/file.h"
-#include "lib/kernel/hash.h"
 #include "threads/vaddr.h"
 
 #ifdef EFILESYS
@@ -49,8 +49,9 @@ struct page {
 	struct frame *frame;   /* Back reference for frame */
 
 	/* Your implementation */
-    struct hash_elem elem_for_hash_table;
     bool writable;
+    uint64_t* pml4;                     /* Page map of the owning process. */
+    struct list_elem elem_for_frame;    /* Element in frame's sharers. */
 
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
@@ -64,10 +65,22 @@ struct page {
 	};
 };
 
-/* The representation of "frame" */
+/* The representation of "frame".
+ * After fork() a frame may be mapped read-only by several processes,
+ * one page each; those pages are kept in SHARERS and a write to any of
+ * them copies the frame (see vm_handle_wp()).  PAGE is one of the
+ * sharers, and the only one when REF_CNT is 1.  PML4 is the page map
+ * PAGE is mapped in, which may belong to any process.  Eviction tests
+ * the accessed bit in the page map of every sharer, and unmaps the
+ * frame from all of them. */
 struct frame {
 	void* kva;
 	struct page* page;
+    uint64_t* pml4;             /* Page map of PAGE's process. */
+    struct list sharers;        /* Pages mapping this frame. */
+    int ref_cnt;                /* Number of pages in SHARERS. */
+    bool pinned;                /* Being filled; not evictable. */
+    bool evicting;              /* Page being written out. */
 
     struct list_elem elem_for_frame_list;
 };
@@ -89,12 +102,17 @@ struct page_operations {
 	if ((page)->operations->destroy) (page)->operations->destroy (page)
 
 /* Representation of current process's memory space.
- * We don't want to force you to obey any specific design for this struct.
- * All designs up to you for this. */
+ * A radix tree over user virtual addresses with the same four levels
+ * as the pml4.  Each node is one page of 512 pointers, and the leaves
+ * point to struct page, so a lookup is four loads and never allocates.
+ * Nodes are allocated on insertion and freed when the table is killed. */
 struct supplemental_page_table {
-    struct hash* hash_table;
+    void** root;                /* Top-level node, NULL while empty. */
 };
 
+/* Callback for spt_for_each(). Returns false to stop the iteration. */
+typedef bool spt_for_each_func (struct page *page, void *aux);
+
 #include "threads/thread.h"
 void supplemental_page_table_init (struct supplemental_page_table *spt);
 bool supplemental_page_table_copy (struct supplemental_page_table *dst,
@@ -104,8 +122,16 @@ struct page *spt_find_page (struct supplemental_page_table *spt,
 		void *va);
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
+bool spt_for_each (struct supplemental_page_table *spt, void *start,
+		void *end, spt_for_each_func *func, void *aux);
+
+/* Free user-pool frames below which kswapd starts evicting, and up to
+ * which it evicts.  Set with the -wml and -wmh kernel options. */
+extern size_t vm_low_watermark;
+extern size_t vm_high_watermark;
 
 void vm_init (void);
+void vm_print_stats (void);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 		bool write, bool not_present);
 
@@ -116,5 +142,6 @@ bool vm_alloc_page_with_initializer (enum vm_type type, void *upage,
 void vm_dealloc_page (struct page *page);
 bool vm_claim_page (void *va);
 enum vm_type page_get_type (struct page *page);
+struct frame *page_pin_resident (struct page *page);
 
 #endif  /* VM_VM_H */
@@ -224,20 +224,42 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) {
 	return value_cnt;
 }
 
+/* Returns the index of the first bit in B between START and END,
+   exclusive, that is set to VALUE, or END if there is none.
+   Works an element at a time, skipping elements that hold only
+   !VALUE. */
+static size_t
+find_next (const struct bitmap *b, size_t start, size_t end, bool value) {
+	elem_type flip = value ? 0 : (elem_type) -1;
+	size_t i, last;
+	elem_type e;
+
+	if (start >= end)
+		return end;
+
+	/* Look at the bits of VALUE only, starting at START. */
+	i = elem_idx (start);
+	last = elem_idx (end - 1);
+	e = (b->bits[i] ^ flip) & ((elem_type) -1 << (start % ELEM_BITS));
+	while (e == 0) {
+		if (++i > last)
+			return end;
+		e = b->bits[i] ^ flip;
+	}
+
+	start = i * ELEM_BITS + __builtin_ctzl (e);
+	return start < end ? start : end;
+}
+
 /* Returns true if any bits in B between START and START + CNT,
    exclusive, are set to VALUE, and false otherwise. */
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
-
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			return true;
-	return false;
+	return find_next (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -266,7 +288,13 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt) {
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   Moves a cursor from run to run: it finds where the next run of
+   VALUE starts and where it ends, and if that run is too short,
+   resumes the search past its end.  Both searches skip whole
+   elements, so the cost grows with the number of runs rather than
+   with the number of bits times CNT. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) {
 	ASSERT (b != NULL);
@@ -274,10 +302,21 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) {
 
 	if (cnt <= b->bit_cnt) {
 		size_t last = b->bit_cnt - cnt;
-		size_t i;
-		for (i = start; i <= last; i++)
-			if (!bitmap_contains (b, i, cnt, !value))
+		size_t i = start;
+
+		if (cnt == 0)
+			return i <= last ? i : BITMAP_ERROR;
+		while (i <= last) {
+			size_t end;
+
+			i = find_next (b, i, last + 1, value);
+			if (i > last)
+				break;
+			end = find_next (b, i, i + cnt, !value);
+			if (end == i + cnt)
 				return i;
+			i = end;
+		}
 	}
 	return BITMAP_ERROR;
 }
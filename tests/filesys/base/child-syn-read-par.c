@@ -0,0 +1,43 @@
+/* Child process for syn-read-par test.
+   Reads its own file, "data<N>", CHUNK_SIZE bytes at a time and
+   checks the contents. */
+
+#include <random.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/filesys/base/syn-read-par.h"
+
+const char *test_name = "child-syn-read-par";
+
+static char buf[FILE_SIZE];
+static char chunk[CHUNK_SIZE];
+
+int
+main (int argc, const char *argv[])
+{
+	char name[16];
+	int child_idx;
+	size_t ofs;
+	int fd;
+
+	quiet = true;
+
+	CHECK (argc == 2, "argc must be 2, actually %d", argc);
+	child_idx = atoi (argv[1]);
+
+	snprintf (name, sizeof name, "data%d", child_idx);
+	random_init (child_idx);
+	random_bytes (buf, sizeof buf);
+
+	CHECK ((fd = open (name)) > 1, "open \"%s\"", name);
+	for (ofs = 0; ofs < sizeof buf; ofs += CHUNK_SIZE) {
+		CHECK (read (fd, chunk, CHUNK_SIZE) == CHUNK_SIZE,
+				"read \"%s\"", name);
+		compare_bytes (chunk, buf + ofs, CHUNK_SIZE, ofs, name);
+	}
+	close (fd);
+
+	return child_idx;
+}
@@ -0,0 +1,60 @@
+/* Creates 10,000 empty files in the root directory and opens each
+   of them, timing the creates and the opens in batches.  With an
+   indexed directory neither should slow down as the directory
+   fills up. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 10000
+#define BATCH_CNT 5
+
+static inline uint64_t
+rdtsc (void) {
+	uint32_t lo, hi;
+	asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64_t) hi << 32) | lo;
+}
+
+void
+test_main (void)
+{
+	const int batch_size = FILE_CNT / BATCH_CNT;
+	char name[16];
+	int i = 0;
+
+	for (int batch = 0; batch < BATCH_CNT; batch++) {
+		int first = i;
+		uint64_t create_cycles = 0;
+		uint64_t open_cycles = 0;
+
+		for (; i < first + batch_size; i++) {
+			uint64_t start;
+
+			snprintf (name, sizeof name, "f%d", i);
+			start = rdtsc ();
+			if (!create (name, 0))
+				fail ("create \"%s\" failed", name);
+			create_cycles += rdtsc () - start;
+		}
+
+		for (int j = first; j < i; j++) {
+			uint64_t start;
+			int fd;
+
+			snprintf (name, sizeof name, "f%d", j);
+			start = rdtsc ();
+			fd = open (name);
+			open_cycles += rdtsc () - start;
+			if (fd < 2)
+				fail ("open \"%s\" failed", name);
+			close (fd);
+		}
+
+		msg ("%d files: create %llu cycles, open %llu cycles", i,
+				create_cycles / batch_size, open_cycles / batch_size);
+	}
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+fail "Not every batch was timed.\n"
+  if grep (/^\(lg-dir-lookup\) \d+ files: create \d+ cycles, open \d+ cycles$/, @output) != 5;
+fail "Benchmark did not finish.\n"
+  if !grep (/^lg-dir-lookup: exit\(0\)$/, @output);
+pass;
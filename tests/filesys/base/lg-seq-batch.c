@@ -0,0 +1,9 @@
+/* Writes out a large file sequentially in page-sized blocks, then
+   reads it back to verify that it was written properly.  The buffer
+   cache writes back and reads ahead runs of consecutive sectors, and
+   the disk elevator merges queued requests, so each command to the
+   file system disk should move several sectors. */
+
+#define TEST_SIZE 75678
+#define BLOCK_SIZE 4096
+#include "tests/filesys/base/seq-block.inc"
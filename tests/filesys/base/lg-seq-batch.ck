@@ -0,0 +1,28 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(lg-seq-batch) begin
+(lg-seq-batch) create "noodle"
+(lg-seq-batch) open "noodle"
+(lg-seq-batch) writing "noodle"
+(lg-seq-batch) close "noodle"
+(lg-seq-batch) open "noodle" for verification
+(lg-seq-batch) verified contents of "noodle"
+(lg-seq-batch) close "noodle"
+(lg-seq-batch) end
+EOF
+
+# Each command to the file system disk should move a run of sectors,
+# not one.
+our ($test);
+my ($stats) = grep (/^hd0:1: /, read_text_file ("$test.output"));
+fail "File system disk statistics were not reported.\n"
+  if !defined $stats
+     || $stats !~ /^hd0:1: (\d+) reads, (\d+) writes in (\d+) commands$/;
+my ($sectors, $commands) = ($1 + $2, $3);
+fail "File system disk took $commands commands for $sectors sectors, "
+  . "fewer than 4 sectors per command.\n"
+  if $commands * 4 > $sectors;
+pass;
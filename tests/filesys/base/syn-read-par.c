@@ -0,0 +1,61 @@
+/* Times readers that each read a different file: first a single
+   reader, then CHILD_CNT readers at once.  Without a global file
+   system lock the concurrent readers do not wait for each other
+   outside the disk, so the second run should take well under
+   CHILD_CNT times the first.  The cycle counts depend on the host,
+   so they are reported for comparison, not checked. */
+
+#include <random.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/filesys/base/syn-read-par.h"
+
+static char buf[FILE_SIZE];
+
+static inline uint64_t
+rdtsc (void) {
+	uint32_t lo, hi;
+	asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64_t) hi << 32) | lo;
+}
+
+/* Runs CNT readers at once and returns the cycles they took. */
+static uint64_t
+run_readers (size_t cnt) {
+	pid_t children[CHILD_CNT];
+	uint64_t start = rdtsc ();
+
+	exec_children ("child-syn-read-par", children, cnt);
+	wait_children (children, cnt);
+	return rdtsc () - start;
+}
+
+void
+test_main (void)
+{
+	char name[16];
+	uint64_t one, all;
+	int fd;
+
+	quiet = true;
+	for (int i = 0; i < CHILD_CNT; i++) {
+		snprintf (name, sizeof name, "data%d", i);
+		random_init (i);
+		random_bytes (buf, sizeof buf);
+		CHECK (create (name, sizeof buf), "create \"%s\"", name);
+		CHECK ((fd = open (name)) > 1, "open \"%s\"", name);
+		CHECK (write (fd, buf, sizeof buf) == sizeof buf,
+				"write \"%s\"", name);
+		close (fd);
+	}
+
+	one = run_readers (1);
+	all = run_readers (CHILD_CNT);
+	quiet = false;
+
+	msg ("1 reader: %llu cycles", one);
+	msg ("%d readers: %llu cycles", CHILD_CNT, all);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+fail "Single reader was not timed.\n"
+  if !grep (/^\(syn-read-par\) 1 reader: \d+ cycles$/, @output);
+fail "Concurrent readers were not timed.\n"
+  if !grep (/^\(syn-read-par\) \d+ readers: \d+ cycles$/, @output);
+fail "Benchmark did not finish.\n"
+  if !grep (/^syn-read-par: exit\(0\)$/, @output);
+pass;
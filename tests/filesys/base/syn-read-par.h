@@ -0,0 +1,14 @@
+#ifndef TESTS_FILESYS_BASE_SYN_READ_PAR_H
+#define TESTS_FILESYS_BASE_SYN_READ_PAR_H
+
+/* Readers, each with a file of its own. */
+#define CHILD_CNT 4
+
+/* Bytes in each file.  Together the files are larger than the
+   buffer cache, so the readers wait on the disk. */
+#define FILE_SIZE 32768
+
+/* Bytes read per read() call. */
+#define CHUNK_SIZE 512
+
+#endif /* tests/filesys/base/syn-read-par.h */
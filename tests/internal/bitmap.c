@@ -0,0 +1,130 @@
+/* Test program and microbenchmark for bitmap_scan() in
+   lib/kernel/bitmap.c.
+
+   Fragments bitmaps of a few sizes and densities, checks that
+   bitmap_scan() agrees with a scan that tests one candidate
+   position at a time, and prints how many cycles each takes.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <random.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/test.h"
+
+/* Bitmap sizes to test, in bits. */
+static const size_t sizes[] = {1024, 16384};
+
+/* Percentage of bits set by fragment(). */
+static const int densities[] = {10, 50, 90};
+
+/* Run lengths to scan for. */
+static const size_t counts[] = {1, 8, 64};
+
+static void fragment (struct bitmap *, int density);
+static size_t naive_scan (const struct bitmap *, size_t start, size_t cnt,
+                          bool value);
+
+static inline uint64_t
+rdtsc (void)
+{
+  uint32_t lo, hi;
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+/* Test and time bitmap_scan(). */
+void
+test (void)
+{
+  size_t s, d, c;
+
+  for (s = 0; s < sizeof sizes / sizeof *sizes; s++)
+    for (d = 0; d < sizeof densities / sizeof *densities; d++)
+      {
+        struct bitmap *b = bitmap_create (sizes[s]);
+        ASSERT (b != NULL);
+        fragment (b, densities[d]);
+
+        for (c = 0; c < sizeof counts / sizeof *counts; c++)
+          {
+            uint64_t naive_cycles = 0, scan_cycles = 0;
+            size_t start;
+
+            /* Scan for free runs from every 64th position, the way
+               repeated allocations walk the map. */
+            for (start = 0; start < sizes[s]; start += 64)
+              {
+                uint64_t t0, t1, t2;
+                size_t expected, actual;
+
+                t0 = rdtsc ();
+                expected = naive_scan (b, start, counts[c], false);
+                t1 = rdtsc ();
+                actual = bitmap_scan (b, start, counts[c], false);
+                t2 = rdtsc ();
+
+                ASSERT (actual == expected);
+                naive_cycles += t1 - t0;
+                scan_cycles += t2 - t1;
+              }
+
+            printf ("bitmap_scan: %zu bits, %d%% set, runs of %zu: "
+                    "naive %llu cycles, word-at-a-time %llu cycles\n",
+                    sizes[s], densities[d], counts[c],
+                    (unsigned long long) naive_cycles,
+                    (unsigned long long) scan_cycles);
+          }
+
+        bitmap_destroy (b);
+      }
+
+  printf ("bitmap_scan: PASS\n");
+}
+
+/* Sets about DENSITY percent of the bits in B, in runs of random
+   length, so that free runs are scattered across the map. */
+static void
+fragment (struct bitmap *b, int density)
+{
+  size_t i = 0;
+
+  bitmap_set_all (b, false);
+  while (i < bitmap_size (b))
+    {
+      size_t run = random_ulong () % 16 + 1;
+      bool value = (int) (random_ulong () % 100) < density;
+
+      if (run > bitmap_size (b) - i)
+        run = bitmap_size (b) - i;
+      bitmap_set_multiple (b, i, run, value);
+      i += run;
+    }
+}
+
+/* The old bitmap_scan(): tests every candidate position with
+   bitmap_contains(), one bit at a time. */
+static size_t
+naive_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  if (cnt <= bitmap_size (b))
+    {
+      size_t last = bitmap_size (b) - cnt;
+      size_t i, j;
+
+      for (i = start; i <= last; i++)
+        {
+          for (j = 0; j < cnt; j++)
+            if (bitmap_test (b, i + j) != value)
+              break;
+          if (j == cnt)
+            return i;
+        }
+    }
+  return BITMAP_ERROR;
+}
@@ -0,0 +1,134 @@
+/* Puts hundreds of threads to sleep at once and checks that
+   each of them wakes up on or after its alarm.  Reports the time
+   spent in the timer interrupt handler, both while nothing is due
+   and while the sleepers are being woken up, so that the cost of
+   the sleep queue can be compared as the number of sleepers
+   grows.
+
+   Each thread takes a page for itself and N_FDT more for its
+   file descriptor table, so SLEEPER_CNT is kept small enough for
+   all of them to fit in the kernel pool at the default MEMORY. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define SLEEPER_CNT 300         /* Number of sleeping threads. */
+#define WAKE_SPREAD 50          /* Alarms are spread over this many ticks. */
+
+/* Information about the test. */
+struct sleep_test 
+  {
+    int64_t wake_tick;          /* Earliest alarm of any sleeper. */
+    struct semaphore go;        /* Released once wake_tick is set. */
+    struct semaphore done;      /* Upped by each sleeper on wakeup. */
+    int early_cnt;              /* Number of sleepers woken too early. */
+  };
+
+/* Information about an individual thread in the test. */
+struct sleep_thread 
+  {
+    struct sleep_test *test;    /* Info shared between all threads. */
+    int id;                     /* Sleeper ID. */
+  };
+
+static void sleeper (void *);
+static void report (const char *, int64_t ticks, uint64_t cycles);
+
+void
+test_alarm_stress (void) 
+{
+  struct sleep_test test;
+  struct sleep_thread *threads;
+  int64_t ticks0, ticks1, ticks2;
+  uint64_t cycles0, cycles1, cycles2;
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  msg ("Creating %d threads to sleep at once.", SLEEPER_CNT);
+
+  threads = malloc (sizeof *threads * SLEEPER_CNT);
+  if (threads == NULL)
+    PANIC ("couldn't allocate memory for test");
+
+  sema_init (&test.go, 0);
+  sema_init (&test.done, 0);
+  test.early_cnt = 0;
+
+  for (i = 0; i < SLEEPER_CNT; i++)
+    {
+      struct sleep_thread *t = threads + i;
+      char name[16];
+
+      t->test = &test;
+      t->id = i;
+      snprintf (name, sizeof name, "sleeper %d", i);
+      if (thread_create (name, PRI_DEFAULT, sleeper, t) == TID_ERROR)
+        fail ("couldn't create thread %d", i);
+    }
+
+  /* Let every sleeper go to sleep, then measure ticks on which
+     nothing is due. */
+  test.wake_tick = timer_ticks () + 200;
+  for (i = 0; i < SLEEPER_CNT; i++)
+    sema_up (&test.go);
+  timer_sleep (50);
+
+  ticks0 = timer_ticks ();
+  cycles0 = timer_interrupt_cycles ();
+  timer_sleep (100);
+  ticks1 = timer_ticks ();
+  cycles1 = timer_interrupt_cycles ();
+
+  /* Wait for every sleeper to wake up. */
+  for (i = 0; i < SLEEPER_CNT; i++)
+    sema_down (&test.done);
+  ticks2 = timer_ticks ();
+  cycles2 = timer_interrupt_cycles ();
+
+  report ("idle", ticks1 - ticks0, cycles1 - cycles0);
+  report ("wakeup", ticks2 - ticks1, cycles2 - cycles1);
+
+  if (test.early_cnt != 0)
+    fail ("%d threads woke up before their alarm", test.early_cnt);
+  msg ("All %d threads woke up on time.", SLEEPER_CNT);
+
+  free (threads);
+}
+
+/* Prints the average handler cost over TICKS ticks. */
+static void
+report (const char *phase, int64_t ticks, uint64_t cycles) 
+{
+  if (ticks <= 0)
+    ticks = 1;
+  printf ("alarm-stress: %s: %"PRId64" ticks, %"PRIu64" cycles/tick "
+          "in timer interrupt\n", phase, ticks, cycles / ticks);
+}
+
+/* Sleeper thread. */
+static void
+sleeper (void *t_) 
+{
+  struct sleep_thread *t = t_;
+  struct sleep_test *test = t->test;
+  int64_t alarm;
+
+  sema_down (&test->go);
+  alarm = test->wake_tick + t->id % WAKE_SPREAD;
+  timer_sleep (alarm - timer_ticks ());
+  if (timer_ticks () < alarm)
+    {
+      enum intr_level old_level = intr_disable ();
+      test->early_cnt++;
+      intr_set_level (old_level);
+    }
+  sema_up (&test->done);
+}
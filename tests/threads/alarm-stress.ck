@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+fail "Timer interrupt cost was not reported.\n"
+  if grep (/cycles\/tick in timer interrupt$/, @output) != 2;
+fail "Not all sleepers woke up on time.\n"
+  if !grep (/^\(alarm-stress\) All \d+ threads woke up on time\.$/, @output);
+pass;
@@ -0,0 +1,93 @@
+/* Measures how the cost of the timer interrupt handler grows
+   with the number of threads under the MLFQS.
+
+   The main thread creates batches of threads that immediately
+   block, then spins for a few seconds and reports the average
+   number of TSC cycles spent in the timer interrupt per tick.
+   The per-tick MLFQS bookkeeping should stay roughly flat as the
+   number of threads grows.  This is a benchmark: the cycle counts
+   depend on the host, so they are reported for comparison between
+   kernels rather than checked.  The largest count is bounded by the
+   kernel pool: each thread takes a page and its N_FDT-page file
+   descriptor table. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Spin time for each measurement, long enough to cover a few
+   once-per-second recalculations. */
+#define SPIN_TICKS (3 * TIMER_FREQ)
+
+static const int thread_counts[] = {0, 64, 128, 256};
+#define STEP_CNT (sizeof thread_counts / sizeof *thread_counts)
+
+struct tick_cost_test
+  {
+    struct semaphore release;   /* Upped to let blocked threads exit. */
+    struct semaphore done;      /* Upped by each thread as it exits. */
+  };
+
+static void blocked_thread (void *);
+
+void
+test_mlfqs_tick_cost (void) 
+{
+  struct tick_cost_test test;
+  int thread_cnt = 0;
+  size_t i;
+
+  ASSERT (thread_mlfqs);
+
+  msg ("Measuring timer interrupt cost with up to %d blocked threads.",
+       thread_counts[STEP_CNT - 1]);
+
+  sema_init (&test.release, 0);
+  sema_init (&test.done, 0);
+
+  for (i = 0; i < STEP_CNT; i++) 
+    {
+      int64_t start_time;
+      uint64_t start_cycles, cycles;
+
+      for (; thread_cnt < thread_counts[i]; thread_cnt++) 
+        {
+          char name[24];
+          snprintf (name, sizeof name, "blocked %d", thread_cnt);
+          if (thread_create (name, PRI_DEFAULT, blocked_thread, &test)
+              == TID_ERROR)
+            fail ("couldn't create thread %d", thread_cnt);
+        }
+      timer_sleep (TIMER_FREQ);
+
+      start_time = timer_ticks ();
+      start_cycles = timer_interrupt_cycles ();
+      while (timer_elapsed (start_time) < SPIN_TICKS)
+        continue;
+      cycles = timer_interrupt_cycles () - start_cycles;
+
+      printf ("mlfqs-tick-cost: %d threads: %"PRIu64" cycles/tick\n",
+              thread_cnt, cycles / SPIN_TICKS);
+    }
+
+  for (i = 0; i < (size_t) thread_cnt; i++)
+    sema_up (&test.release);
+  for (i = 0; i < (size_t) thread_cnt; i++)
+    sema_down (&test.done);
+
+  msg ("All %d threads exited.", thread_cnt);
+}
+
+static void
+blocked_thread (void *test_) 
+{
+  struct tick_cost_test *test = test_;
+
+  sema_down (&test->release);
+  sema_up (&test->done);
+}
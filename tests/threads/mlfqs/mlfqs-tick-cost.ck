@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+fail "Timer interrupt cost was not reported for every thread count.\n"
+  if grep (/^mlfqs-tick-cost: \d+ threads: \d+ cycles\/tick$/, @output) != 4;
+fail "Blocked threads did not all exit.\n"
+  if !grep (/^\(mlfqs-tick-cost\) All \d+ threads exited\.$/, @output);
+pass;
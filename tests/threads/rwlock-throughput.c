@@ -0,0 +1,185 @@
+/* Measures reader throughput on a read-mostly lock under
+   contention.
+
+   READER_CNT threads repeatedly take the lock for reading and
+   spin inside it, while one writer takes it every tick.  The run
+   is done once with a plain lock and once with a reader-writer
+   lock.  With the plain lock a reader preempted inside the lock
+   stalls every other reader; with the reader-writer lock they
+   carry on.  The read counts are only reported, since on one CPU
+   both runs are CPU-bound.  What is checked is that readers were
+   inside the reader-writer lock together, and never inside the
+   plain lock together. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define READER_CNT 8
+
+/* Length of each run. */
+#define RUN_TICKS (2 * TIMER_FREQ)
+
+/* Iterations spun inside the lock per read. */
+#define READ_SPIN 2000
+
+struct throughput_test
+  {
+    bool use_rwlock;            /* Use RWLOCK rather than LOCK? */
+    struct lock lock;
+    struct rwlock rwlock;
+    int64_t end;                /* Tick at which threads stop. */
+    long long reads[READER_CNT]; /* Reads completed by each reader. */
+    int inside;                 /* Readers inside the lock now. */
+    int max_inside;             /* Most readers inside at once. */
+    struct semaphore done;      /* Upped by each thread as it exits. */
+  };
+
+struct reader
+  {
+    struct throughput_test *test;
+    int idx;
+  };
+
+static thread_func reader_thread;
+static thread_func writer_thread;
+
+static long long run (struct throughput_test *, bool use_rwlock);
+static void enter (struct throughput_test *);
+static void leave (struct throughput_test *);
+
+void
+test_rwlock_throughput (void) 
+{
+  static struct throughput_test test;
+  long long lock_reads, rwlock_reads;
+  int lock_inside;
+
+  lock_init (&test.lock);
+  rwlock_init (&test.rwlock);
+  sema_init (&test.done, 0);
+
+  lock_reads = run (&test, false);
+  lock_inside = test.max_inside;
+  rwlock_reads = run (&test, true);
+
+  printf ("rwlock-throughput: %d readers: lock %lld reads, "
+          "rwlock %lld reads\n", READER_CNT, lock_reads, rwlock_reads);
+
+  if (lock_inside != 1)
+    fail ("%d readers were inside the plain lock at once", lock_inside);
+  if (test.max_inside < 2)
+    fail ("readers were never inside the reader-writer lock together");
+  msg ("readers shared the reader-writer lock");
+}
+
+/* Runs the readers and the writer for RUN_TICKS and returns the
+   number of reads completed. */
+static long long
+run (struct throughput_test *test, bool use_rwlock) 
+{
+  struct reader readers[READER_CNT];
+  long long total = 0;
+  int i;
+
+  test->use_rwlock = use_rwlock;
+  test->inside = test->max_inside = 0;
+  test->end = timer_ticks () + RUN_TICKS;
+  for (i = 0; i < READER_CNT; i++) 
+    {
+      char name[16];
+
+      readers[i].test = test;
+      readers[i].idx = i;
+      test->reads[i] = 0;
+      snprintf (name, sizeof name, "reader %d", i);
+      thread_create (name, PRI_DEFAULT, reader_thread, &readers[i]);
+    }
+  thread_create ("writer", PRI_DEFAULT, writer_thread, test);
+
+  for (i = 0; i < READER_CNT + 1; i++)
+    sema_down (&test->done);
+  for (i = 0; i < READER_CNT; i++)
+    total += test->reads[i];
+  return total;
+}
+
+static void
+spin (void) 
+{
+  volatile int i;
+
+  for (i = 0; i < READ_SPIN; i++)
+    continue;
+}
+
+/* Counts the calling reader as inside TEST's lock. */
+static void
+enter (struct throughput_test *test) 
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (++test->inside > test->max_inside)
+    test->max_inside = test->inside;
+  intr_set_level (old_level);
+}
+
+/* Counts the calling reader as out of TEST's lock. */
+static void
+leave (struct throughput_test *test) 
+{
+  enum intr_level old_level = intr_disable ();
+
+  test->inside--;
+  intr_set_level (old_level);
+}
+
+static void
+reader_thread (void *reader_) 
+{
+  struct reader *reader = reader_;
+  struct throughput_test *test = reader->test;
+
+  while (timer_ticks () < test->end) 
+    {
+      if (test->use_rwlock)
+        rwlock_acquire_read (&test->rwlock);
+      else
+        lock_acquire (&test->lock);
+      enter (test);
+      spin ();
+      leave (test);
+      if (test->use_rwlock)
+        rwlock_release_read (&test->rwlock);
+      else
+        lock_release (&test->lock);
+      test->reads[reader->idx]++;
+    }
+  sema_up (&test->done);
+}
+
+static void
+writer_thread (void *test_) 
+{
+  struct throughput_test *test = test_;
+
+  while (timer_ticks () < test->end) 
+    {
+      if (test->use_rwlock)
+        rwlock_acquire_write (&test->rwlock);
+      else
+        lock_acquire (&test->lock);
+      spin ();
+      if (test->use_rwlock)
+        rwlock_release_write (&test->rwlock);
+      else
+        lock_release (&test->lock);
+      timer_sleep (1);
+    }
+  sema_up (&test->done);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+fail "Reader throughput was not reported.\n"
+  if !grep (/^rwlock-throughput: \d+ readers: lock \d+ reads, rwlock \d+ reads$/, @output);
+fail "Readers did not share the reader-writer lock.\n"
+  if !grep (/^\(rwlock-throughput\) readers shared the reader-writer lock$/, @output);
+fail "Test did not finish.\n"
+  if !grep (/^\(rwlock-throughput\) end$/, @output);
+pass;
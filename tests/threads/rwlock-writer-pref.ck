@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rwlock-writer-pref) begin
+(rwlock-writer-pref) This thread should have priority 32.  Actual priority: 32.
+(rwlock-writer-pref) reader: could not get in ahead of the writer
+(rwlock-writer-pref) This thread should have priority 33.  Actual priority: 33.
+(rwlock-writer-pref) writer: got the lock
+(rwlock-writer-pref) reader: got the lock
+(rwlock-writer-pref) reader: done
+(rwlock-writer-pref) writer: done
+(rwlock-writer-pref) writer, reader must already have got the lock, in that order.
+(rwlock-writer-pref) This thread should have priority 31.  Actual priority: 31.
+(rwlock-writer-pref) end
+EOF
+pass;
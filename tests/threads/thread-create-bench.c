@@ -0,0 +1,73 @@
+/* Measures how fast threads can be created and reaped.
+
+   First creates THREAD_CNT threads one at a time, each of which
+   exits as soon as it runs, and then the same number in batches
+   of BATCH_CNT that are all alive at once.  Prints the average
+   number of cycles per thread_create() and exit for each, so that
+   the cost of allocating and initializing a thread can be
+   compared between kernels. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define THREAD_CNT 512
+#define BATCH_CNT 16
+
+static thread_func exit_thread;
+
+static inline uint64_t
+rdtsc (void)
+{
+  uint32_t lo, hi;
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+void
+test_thread_create_bench (void)
+{
+  struct semaphore done;
+  uint64_t start, serial_cycles, batch_cycles;
+  int i, j;
+
+  sema_init (&done, 0);
+
+  start = rdtsc ();
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      tid_t tid = thread_create ("exiter", PRI_DEFAULT, exit_thread, &done);
+      ASSERT (tid != TID_ERROR);
+      sema_down (&done);
+    }
+  serial_cycles = (rdtsc () - start) / THREAD_CNT;
+
+  start = rdtsc ();
+  for (i = 0; i < THREAD_CNT; i += BATCH_CNT)
+    {
+      for (j = 0; j < BATCH_CNT; j++)
+        {
+          tid_t tid = thread_create ("exiter", PRI_DEFAULT, exit_thread,
+                                     &done);
+          ASSERT (tid != TID_ERROR);
+        }
+      for (j = 0; j < BATCH_CNT; j++)
+        sema_down (&done);
+    }
+  batch_cycles = (rdtsc () - start) / THREAD_CNT;
+
+  printf ("thread-create-bench: %d threads: serial %"PRIu64" cycles, "
+          "batches of %d %"PRIu64" cycles\n",
+          THREAD_CNT, serial_cycles, BATCH_CNT, batch_cycles);
+}
+
+static void
+exit_thread (void *done_)
+{
+  struct semaphore *done = done_;
+
+  sema_up (done);
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+fail "Thread creation cost was not reported.\n"
+  if !grep (/^thread-create-bench: \d+ threads: serial \d+ cycles, batches of \d+ \d+ cycles$/, @output);
+fail "Test did not finish.\n"
+  if !grep (/^\(thread-create-bench\) end$/, @output);
+pass;
@@ -0,0 +1,60 @@
+/* Times read() and write() system calls on buffers from 64 bytes
+   to 64 kB.  Argument validation is done per page, so the cost of
+   a call should grow with the number of bytes actually copied by
+   the file system and not with a per-byte check on top of it. */
+
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ITERATIONS 16
+
+static char buf[64 * 1024];
+
+static inline uint64_t
+rdtsc (void) {
+  uint32_t lo, hi;
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+void
+test_main (void) 
+{
+  size_t size;
+  int fd;
+  int i;
+
+  CHECK (create ("bench.dat", sizeof buf), "create \"bench.dat\"");
+  CHECK ((fd = open ("bench.dat")) > 1, "open \"bench.dat\"");
+
+  for (size = 64; size <= sizeof buf; size *= 4)
+    {
+      uint64_t start, write_cycles, read_cycles;
+
+      start = rdtsc ();
+      for (i = 0; i < ITERATIONS; i++)
+        {
+          seek (fd, 0);
+          if (write (fd, buf, size) != (int) size)
+            fail ("write %zu bytes failed", size);
+        }
+      write_cycles = (rdtsc () - start) / ITERATIONS;
+
+      start = rdtsc ();
+      for (i = 0; i < ITERATIONS; i++)
+        {
+          seek (fd, 0);
+          if (read (fd, buf, size) != (int) size)
+            fail ("read %zu bytes failed", size);
+        }
+      read_cycles = (rdtsc () - start) / ITERATIONS;
+
+      msg ("%zu bytes: write %llu cycles/call, read %llu cycles/call",
+           size, write_cycles, read_cycles);
+    }
+
+  msg ("close \"bench.dat\"");
+  close (fd);
+}
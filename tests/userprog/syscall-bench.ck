@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+fail "Not every buffer size was timed.\n"
+  if grep (/^\(syscall-bench\) \d+ bytes: write \d+ cycles\/call, read \d+ cycles\/call$/, @output) != 6;
+fail "Benchmark did not finish.\n"
+  if !grep (/^syscall-bench: exit\(0\)$/, @output);
+pass;
@@ -0,0 +1,53 @@
+/* Measures fork() latency against the number of resident pages
+   in the parent.  With copy-on-write, fork only copies page table
+   entries, so the latency should grow far slower than the amount
+   of memory the parent has touched. */
+
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define ARENA_PAGES 512
+#define ITERATIONS 4
+
+static char arena[ARENA_PAGES * PAGE_SIZE];
+
+static inline uint64_t
+rdtsc (void) {
+	uint32_t lo, hi;
+	asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64_t) hi << 32) | lo;
+}
+
+void
+test_main (void)
+{
+	static const size_t sizes[] = { 0, 64, 256, ARENA_PAGES };
+	size_t touched = 0;
+
+	for (size_t i = 0; i < sizeof sizes / sizeof *sizes; i++) {
+		uint64_t cycles = 0;
+
+		for (; touched < sizes[i]; touched++)
+			arena[touched * PAGE_SIZE] = (char) touched;
+
+		for (int j = 0; j < ITERATIONS; j++) {
+			uint64_t start = rdtsc ();
+			pid_t child = fork ("child");
+
+			if (child == 0)
+				exit (arena[0]);
+			cycles += rdtsc () - start;
+
+			if (child < 0)
+				fail ("fork failed");
+			if (wait (child) != arena[0])
+				fail ("wrong child exit status");
+		}
+
+		msg ("%zu resident pages: fork %llu cycles", sizes[i],
+				cycles / ITERATIONS);
+	}
+}
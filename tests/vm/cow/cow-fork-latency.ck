@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+fail "Not every address-space size was timed.\n"
+  if grep (/^\(cow-fork-latency\) \d+ resident pages: fork \d+ cycles$/, @output) != 4;
+fail "Benchmark did not finish.\n"
+  if !grep (/^cow-fork-latency: exit\(0\)$/, @output);
+pass;
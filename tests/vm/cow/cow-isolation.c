@@ -0,0 +1,70 @@
+/* Checks that after fork, writes by the parent and by the child
+   are not visible to each other, including for pages that were
+   swapped out when fork was called.  The arena is larger than the
+   user pool the test runs with, so part of it is on swap at that
+   point. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define ARENA_PAGES 2048
+
+static char arena[ARENA_PAGES * PAGE_SIZE];
+
+/* Fills every page of the arena with a byte derived from its number
+   and SEED. */
+static void
+fill (int seed)
+{
+	for (size_t i = 0; i < ARENA_PAGES; i++)
+		memset (arena + i * PAGE_SIZE, (char) (i * 3 + seed), PAGE_SIZE);
+}
+
+/* Returns true if every page still holds what fill (SEED) put there.
+   The first and last byte of each page are checked. */
+static bool
+holds (int seed)
+{
+	for (size_t i = 0; i < ARENA_PAGES; i++) {
+		char expected = (char) (i * 3 + seed);
+		if (arena[i * PAGE_SIZE] != expected
+				|| arena[i * PAGE_SIZE + PAGE_SIZE - 1] != expected)
+			return false;
+	}
+	return true;
+}
+
+void
+test_main (void)
+{
+	pid_t child;
+	int handle;
+
+	fill (1);
+	msg ("fill %d pages", ARENA_PAGES);
+
+	child = fork ("child");
+	if (child == 0) {
+		/* Wait until the parent has overwritten the arena. */
+		while ((handle = open ("parent-wrote")) < 0)
+			continue;
+		close (handle);
+
+		CHECK (holds (1), "child sees the parent's pages as of fork");
+		fill (3);
+		CHECK (holds (3), "child's writes stick");
+		return;
+	}
+	if (child < 0)
+		fail ("fork failed");
+
+	fill (2);
+	if (!create ("parent-wrote", 0))
+		fail ("create \"parent-wrote\"");
+	if (wait (child) != 0)
+		fail ("child failed");
+	CHECK (holds (2), "parent does not see the child's writes");
+}
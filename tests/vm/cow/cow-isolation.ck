@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cow-isolation) begin
+(cow-isolation) fill 2048 pages
+(cow-isolation) child sees the parent's pages as of fork
+(cow-isolation) child's writes stick
+(cow-isolation) end
+(cow-isolation) parent does not see the child's writes
+(cow-isolation) end
+EOF
+pass;
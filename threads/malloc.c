@@ -5,77 +5,177 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 
-/* A simple implementation of malloc().
-
-   The size of each request, in bytes, is rounded up to a power
-   of 2 and assigned to the "descriptor" that manages blocks of
-   that size.  The descriptor keeps a list of free blocks.  If
-   the free list is nonempty, one of its blocks is used to
-   satisfy the request.
-
-   Otherwise, a new page of memory, called an "arena", is
-   obtained from the page allocator (if none is available,
-   malloc() returns a null pointer).  The new arena is divided
-   into blocks, all of which are added to the descriptor's free
-   list.  Then we return one of the new blocks.
-
-   When we free a block, we add it to its descriptor's free list.
-   But if the arena that the block was in now has no in-use
-   blocks, we remove all of the arena's blocks from the free list
-   and give the arena back to the page allocator.
-
-   We can't handle blocks bigger than 2 kB using this scheme,
-   because they're too big to fit in a single page with a
-   descriptor.  We handle those by allocating contiguous pages
-   with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
-
-/* Descriptor. */
-struct desc {
-	size_t block_size;          /* Size of each element in bytes. */
-	size_t blocks_per_arena;    /* Number of blocks in an arena. */
-	struct list free_list;      /* List of free blocks. */
-	struct lock lock;           /* Lock. */
+/* A slab allocator with a magazine layer.
+
+   Memory is handed out by "caches", each of which manages objects
+   of a single size.  A cache obtains pages, called "slabs", from
+   the page allocator and divides each one into objects.  The slab
+   header sits at the start of its page, so the slab, and through
+   it the cache, of any object is found by rounding its address
+   down to a page boundary.
+
+   In front of its slabs, each cache keeps a "magazine": a small
+   stack of free objects that allocation and freeing use under a
+   spin lock, without taking the cache's sleeping lock.  Only
+   when the magazine is empty, or full, is the lock taken to move
+   half a magazine of objects from, or to, the slabs.  The kernel
+   runs on a single CPU, so one magazine per cache stands in for
+   per-CPU magazines.
+
+   A cache may have a constructor, which is run on each object as
+   it leaves the slabs for the magazine.  Objects must be freed in
+   their constructed state, so an object that only cycles through
+   the magazine is constructed once.
+
+   A slab whose objects are all free is kept for reuse, up to
+   SLAB_EMPTY_MAX of them per cache; beyond that, it goes back to
+   the page allocator.
+
+   malloc() serves requests of up to SLAB_OBJ_MAX bytes from a set
+   of size classes, not all of them powers of 2, each of which is
+   a cache without a constructor.  Bigger requests get contiguous
+   pages from the page allocator, with the page count in the slab
+   header.  free() takes objects from any cache. */
+
+/* Most objects a magazine holds. */
+#define MAGAZINE_SIZE 16
+
+/* Most slabs with no objects in use that a cache keeps. */
+#define SLAB_EMPTY_MAX 2
+
+/* Most caches, counting malloc()'s size classes. */
+#define CACHE_MAX 32
+
+/* Object cache. */
+struct kmem_cache {
+	const char *name;           /* Name, for statistics. */
+	size_t size;                /* Object size requested. */
+	size_t obj_size;            /* Size of each object in bytes. */
+	size_t objs_per_slab;       /* Number of objects in a slab. */
+	void (*ctor) (void *);      /* Constructor, or null. */
+
+	/* Free objects and statistics, guarded by MAGAZINE_LOCK. */
+	struct spinlock magazine_lock;
+	void *magazine[MAGAZINE_SIZE];
+	size_t magazine_cnt;        /* Objects in MAGAZINE. */
+	size_t magazine_max;        /* Capacity, at most MAGAZINE_SIZE. */
+
+	struct lock lock;           /* Protects the slab lists. */
+	struct list partial_slabs;  /* Slabs with free and used objects. */
+	struct list empty_slabs;    /* Slabs with only free objects. */
+	size_t empty_cnt;           /* Number of slabs in EMPTY_SLABS. */
+	size_t slab_cnt;            /* Number of slabs, empty ones too. */
+
+	/* Statistics. */
+	long long alloc_cnt;        /* Allocations. */
+	long long requested_bytes;  /* Bytes asked for by allocations. */
 };
 
-/* Magic number for detecting arena corruption. */
-#define ARENA_MAGIC 0x9a548eed
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x9a548eed
 
-/* Arena. */
-struct arena {
-	unsigned magic;             /* Always set to ARENA_MAGIC. */
-	struct desc *desc;          /* Owning descriptor, null for big block. */
-	size_t free_cnt;            /* Free blocks; pages in big block. */
+/* Slab. */
+struct slab {
+	unsigned magic;             /* Always set to SLAB_MAGIC. */
+	struct kmem_cache *cache;   /* Owning cache, null for big block. */
+	size_t free_cnt;            /* Free objects; pages in big block. */
+	struct list_elem elem;      /* In cache's partial or empty list. */
+	struct block *free_list;    /* Free objects. */
 };
 
-/* Free block. */
+/* Bytes at the start of a slab before its first object. */
+#define SLAB_HEADER_SIZE ROUND_UP (sizeof (struct slab), 16)
+
+/* Largest object that fits in a slab twice. */
+#define SLAB_OBJ_MAX ((PGSIZE - SLAB_HEADER_SIZE) / 2 / 16 * 16)
+
+/* Free object in a slab. */
 struct block {
-	struct list_elem free_elem; /* Free list element. */
+	struct block *next;         /* Next free object. */
 };
 
-/* Our set of descriptors. */
-static struct desc descs[10];   /* Descriptors. */
-static size_t desc_cnt;         /* Number of descriptors. */
+/* Our set of caches. */
+static struct kmem_cache caches[CACHE_MAX];
+static size_t cache_cnt;
+static struct spinlock caches_lock;   /* Protects CACHE_CNT. */
+
+/* malloc()'s size classes, in increasing order. */
+static struct kmem_cache *size_classes[16];
+static size_t size_class_cnt;
 
-static struct arena *block_to_arena (struct block *);
-static struct block *arena_to_block (struct arena *, size_t idx);
+static void *cache_alloc (struct kmem_cache *, size_t size);
+static void cache_free (struct kmem_cache *, void *);
+static struct slab *block_to_slab (void *);
 
-/* Initializes the malloc() descriptors. */
+/* Initializes the malloc() size classes. */
 void
 malloc_init (void) {
-	size_t block_size;
-
-	for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2) {
-		struct desc *d = &descs[desc_cnt++];
-		ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
-		d->block_size = block_size;
-		d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
-		list_init (&d->free_list);
-		lock_init (&d->lock);
+	static const size_t sizes[] = {
+		16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1344,
+		SLAB_OBJ_MAX,
+	};
+	size_t i;
+
+	spinlock_init (&caches_lock);
+	for (i = 0; i < sizeof sizes / sizeof *sizes; i++) {
+		ASSERT (size_class_cnt < sizeof size_classes / sizeof *size_classes);
+		size_classes[size_class_cnt++] =
+			kmem_cache_create ("malloc", sizes[i], NULL);
+	}
+}
+
+/* Creates and returns a cache of objects of SIZE bytes, which may
+   be at most SLAB_OBJ_MAX.  If CTOR is nonnull, it is run on each
+   object before it is first handed out, and objects must be freed
+   in the state it leaves them in.  NAME is used in statistics. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, void (*ctor) (void *)) {
+	struct kmem_cache *c;
+
+	ASSERT (size > 0 && size <= SLAB_OBJ_MAX);
+
+	spinlock_acquire (&caches_lock);
+	ASSERT (cache_cnt < CACHE_MAX);
+	c = &caches[cache_cnt++];
+	spinlock_release (&caches_lock);
+
+	c->name = name;
+	c->size = size;
+	c->obj_size = ROUND_UP (size, sizeof (void *));
+	c->objs_per_slab = (PGSIZE - SLAB_HEADER_SIZE) / c->obj_size;
+	c->ctor = ctor;
+	spinlock_init (&c->magazine_lock);
+	c->magazine_cnt = 0;
+	c->magazine_max = c->objs_per_slab < MAGAZINE_SIZE
+		? c->objs_per_slab : MAGAZINE_SIZE;
+	lock_init (&c->lock);
+	list_init (&c->partial_slabs);
+	list_init (&c->empty_slabs);
+	c->empty_cnt = 0;
+	c->slab_cnt = 0;
+	c->alloc_cnt = 0;
+	c->requested_bytes = 0;
+	return c;
+}
+
+/* Obtains and returns an object from cache C.
+   Returns a null pointer if memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c) {
+	return cache_alloc (c, c->size);
+}
+
+/* Returns OBJ, which must have come from cache C, to C. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj) {
+	if (obj != NULL) {
+		ASSERT (block_to_slab (obj)->cache == c);
+		cache_free (c, obj);
 	}
 }
 
@@ -83,64 +183,32 @@ malloc_init (void) {
    Returns a null pointer if memory is not available. */
 void *
 malloc (size_t size) {
-	struct desc *d;
-	struct block *b;
-	struct arena *a;
+	struct slab *s;
+	size_t i;
 
 	/* A null pointer satisfies a request for 0 bytes. */
 	if (size == 0)
 		return NULL;
 
-	/* Find the smallest descriptor that satisfies a SIZE-byte
+	/* Find the smallest size class that satisfies a SIZE-byte
 	   request. */
-	for (d = descs; d < descs + desc_cnt; d++)
-		if (d->block_size >= size)
-			break;
-	if (d == descs + desc_cnt) {
-		/* SIZE is too big for any descriptor.
-		   Allocate enough pages to hold SIZE plus an arena. */
-		size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
-		a = palloc_get_multiple (0, page_cnt);
-		if (a == NULL)
-			return NULL;
-
-		/* Initialize the arena to indicate a big block of PAGE_CNT
-		   pages, and return it. */
-		a->magic = ARENA_MAGIC;
-		a->desc = NULL;
-		a->free_cnt = page_cnt;
-		return a + 1;
-	}
-
-	lock_acquire (&d->lock);
-
-	/* If the free list is empty, create a new arena. */
-	if (list_empty (&d->free_list)) {
-		size_t i;
-
-		/* Allocate a page. */
-		a = palloc_get_page (0);
-		if (a == NULL) {
-			lock_release (&d->lock);
-			return NULL;
-		}
-
-		/* Initialize arena and add its blocks to the free list. */
-		a->magic = ARENA_MAGIC;
-		a->desc = d;
-		a->free_cnt = d->blocks_per_arena;
-		for (i = 0; i < d->blocks_per_arena; i++) {
-			struct block *b = arena_to_block (a, i);
-			list_push_back (&d->free_list, &b->free_elem);
-		}
-	}
+	for (i = 0; i < size_class_cnt; i++)
+		if (size_classes[i]->obj_size >= size)
+			return cache_alloc (size_classes[i], size);
+
+	/* SIZE is too big for any size class.
+	   Allocate enough pages to hold SIZE plus a slab header. */
+	size_t page_cnt = DIV_ROUND_UP (size + SLAB_HEADER_SIZE, PGSIZE);
+	s = palloc_get_multiple (0, page_cnt);
+	if (s == NULL)
+		return NULL;
 
-	/* Get a block from free list and return it. */
-	b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-	a = block_to_arena (b);
-	a->free_cnt--;
-	lock_release (&d->lock);
-	return b;
+	/* Initialize the slab to indicate a big block of PAGE_CNT
+	   pages, and return it. */
+	s->magic = SLAB_MAGIC;
+	s->cache = NULL;
+	s->free_cnt = page_cnt;
+	return (uint8_t *) s + SLAB_HEADER_SIZE;
 }
 
 /* Allocates and return A times B bytes initialized to zeroes.
@@ -166,11 +234,10 @@ calloc (size_t a, size_t b) {
 /* Returns the number of bytes allocated for BLOCK. */
 static size_t
 block_size (void *block) {
-	struct block *b = block;
-	struct arena *a = block_to_arena (b);
-	struct desc *d = a->desc;
+	struct slab *s = block_to_slab (block);
+	struct kmem_cache *c = s->cache;
 
-	return d != NULL ? d->block_size : PGSIZE * a->free_cnt - pg_ofs (block);
+	return c != NULL ? c->obj_size : PGSIZE * s->free_cnt - pg_ofs (block);
 }
 
 /* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
@@ -197,72 +264,233 @@ realloc (void *old_block, size_t new_size) {
 }
 
 /* Frees block P, which must have been previously allocated with
-   malloc(), calloc(), or realloc(). */
+   malloc(), calloc(), realloc(), or kmem_cache_alloc(). */
 void
 free (void *p) {
 	if (p != NULL) {
-		struct block *b = p;
-		struct arena *a = block_to_arena (b);
-		struct desc *d = a->desc;
+		struct slab *s = block_to_slab (p);
 
-		if (d != NULL) {
-			/* It's a normal block.  We handle it here. */
+		if (s->cache != NULL) {
+			/* It's an object.  Its cache handles it. */
+			cache_free (s->cache, p);
+		} else {
+			/* It's a big block.  Free its pages. */
+			palloc_free_multiple (s, s->free_cnt);
+		}
+	}
+}
 
-#ifndef NDEBUG
-			/* Clear the block to help detect use-after-free bugs. */
-			memset (b, 0xcc, d->block_size);
-#endif
+/* Prints statistics for every cache that has been used. */
+void
+malloc_print_stats (void) {
+	int64_t ticks = timer_ticks ();
+	size_t i;
+
+	for (i = 0; i < cache_cnt; i++) {
+		struct kmem_cache *c = &caches[i];
+		long long allocated = c->alloc_cnt * (long long) c->obj_size;
+
+		if (c->alloc_cnt == 0)
+			continue;
+		printf ("Cache %s-%zu: %lld allocs (%lld/s), %zu slabs, "
+				"%lld%% internal fragmentation\n",
+				c->name, c->obj_size, c->alloc_cnt,
+				c->alloc_cnt * TIMER_FREQ / (ticks > 0 ? ticks : 1),
+				c->slab_cnt,
+				(allocated - c->requested_bytes) * 100 / allocated);
+	}
+}
 
-			lock_acquire (&d->lock);
+/* Returns the slab that block B is inside. */
+static struct slab *
+block_to_slab (void *b) {
+	struct slab *s = pg_round_down (b);
 
-			/* Add block to free list. */
-			list_push_front (&d->free_list, &b->free_elem);
+	/* Check that the slab is valid. */
+	ASSERT (s != NULL);
+	ASSERT (s->magic == SLAB_MAGIC);
 
-			/* If the arena is now entirely unused, free it. */
-			if (++a->free_cnt >= d->blocks_per_arena) {
-				size_t i;
+	/* Check that the block is properly aligned for the slab. */
+	ASSERT (s->cache == NULL
+			|| (pg_ofs (b) - SLAB_HEADER_SIZE) % s->cache->obj_size == 0);
+	ASSERT (s->cache != NULL || pg_ofs (b) == SLAB_HEADER_SIZE);
 
-				ASSERT (a->free_cnt == d->blocks_per_arena);
-				for (i = 0; i < d->blocks_per_arena; i++) {
-					struct block *b = arena_to_block (a, i);
-					list_remove (&b->free_elem);
-				}
-				palloc_free_page (a);
-			}
+	return s;
+}
+
+/* Obtains a page for a new slab of cache C, divides it into free
+   objects and returns it, or returns a null pointer if no page is
+   available.  C's lock must be held. */
+static struct slab *
+slab_create (struct kmem_cache *c) {
+	struct slab *s = palloc_get_page (0);
+	size_t i;
+
+	if (s == NULL)
+		return NULL;
+
+	s->magic = SLAB_MAGIC;
+	s->cache = c;
+	s->free_cnt = c->objs_per_slab;
+	s->free_list = NULL;
+	for (i = c->objs_per_slab; i-- > 0; ) {
+		struct block *b = (struct block *) ((uint8_t *) s
+				+ SLAB_HEADER_SIZE + i * c->obj_size);
+		b->next = s->free_list;
+		s->free_list = b;
+	}
+	c->slab_cnt++;
+	return s;
+}
+
+/* Takes a free object out of C's slabs, preferring slabs already
+   in use, and returns it, or returns a null pointer if memory is
+   not available.  C's lock must be held. */
+static void *
+slab_get (struct kmem_cache *c) {
+	struct slab *s;
+	struct block *b;
+
+	ASSERT (lock_held_by_current_thread (&c->lock));
 
-			lock_release (&d->lock);
+	if (!list_empty (&c->partial_slabs))
+		s = list_entry (list_front (&c->partial_slabs), struct slab, elem);
+	else {
+		if (!list_empty (&c->empty_slabs)) {
+			s = list_entry (list_pop_front (&c->empty_slabs), struct slab, elem);
+			c->empty_cnt--;
 		} else {
-			/* It's a big block.  Free its pages. */
-			palloc_free_multiple (a, a->free_cnt);
-			return;
+			s = slab_create (c);
+			if (s == NULL)
+				return NULL;
 		}
+		list_push_front (&c->partial_slabs, &s->elem);
 	}
+
+	b = s->free_list;
+	s->free_list = b->next;
+	if (--s->free_cnt == 0)
+		list_remove (&s->elem);
+	return b;
 }
-
-/* Returns the arena that block B is inside. */
-static struct arena *
-block_to_arena (struct block *b) {
-	struct arena *a = pg_round_down (b);
-
-	/* Check that the arena is valid. */
-	ASSERT (a != NULL);
-	ASSERT (a->magic == ARENA_MAGIC);
-
-	/* Check that the block is properly aligned for the arena. */
-	ASSERT (a->desc == NULL
-			|| (pg_ofs (b) - sizeof *a) % a->desc->block_size == 0);
-	ASSERT (a->desc != NULL || pg_ofs (b) == sizeof *a);
-
-	return a;
+
+/* Returns OBJ to its slab in C.  A slab left with no objects in
+   use is kept if C has fewer than SLAB_EMPTY_MAX such slabs and
+   freed otherwise.  C's lock must be held. */
+static void
+slab_put (struct kmem_cache *c, void *obj) {
+	struct slab *s = block_to_slab (obj);
+	struct block *b = obj;
+
+	ASSERT (lock_held_by_current_thread (&c->lock));
+	ASSERT (s->cache == c);
+
+	b->next = s->free_list;
+	s->free_list = b;
+	if (s->free_cnt++ == 0)
+		list_push_front (&c->partial_slabs, &s->elem);
+
+	if (s->free_cnt == c->objs_per_slab) {
+		list_remove (&s->elem);
+		if (c->empty_cnt < SLAB_EMPTY_MAX) {
+			list_push_front (&c->empty_slabs, &s->elem);
+			c->empty_cnt++;
+		} else {
+			c->slab_cnt--;
+			palloc_free_page (s);
+		}
+	}
 }
 
-/* Returns the (IDX - 1)'th block within arena A. */
-static struct block *
-arena_to_block (struct arena *a, size_t idx) {
-	ASSERT (a != NULL);
-	ASSERT (a->magic == ARENA_MAGIC);
-	ASSERT (idx < a->desc->blocks_per_arena);
-	return (struct block *) ((uint8_t *) a
-			+ sizeof *a
-			+ idx * a->desc->block_size);
+/* Refills C's empty magazine with up to half its capacity of
+   constructed objects from the slabs and returns one more of them,
+   or returns a null pointer if memory is not available. */
+static void *
+magazine_reload (struct kmem_cache *c) {
+	void *objs[MAGAZINE_SIZE / 2 + 1];
+	size_t want = c->magazine_max / 2 + 1;
+	size_t cnt, i;
+
+	lock_acquire (&c->lock);
+	for (cnt = 0; cnt < want; cnt++) {
+		objs[cnt] = slab_get (c);
+		if (objs[cnt] == NULL)
+			break;
+	}
+	lock_release (&c->lock);
+
+	if (cnt == 0)
+		return NULL;
+	if (c->ctor != NULL)
+		for (i = 0; i < cnt; i++)
+			c->ctor (objs[i]);
+
+	/* Another thread may have filled the magazine meanwhile. */
+	spinlock_acquire (&c->magazine_lock);
+	for (i = 1; i < cnt && c->magazine_cnt < c->magazine_max; i++)
+		c->magazine[c->magazine_cnt++] = objs[i];
+	spinlock_release (&c->magazine_lock);
+
+	if (i < cnt) {
+		lock_acquire (&c->lock);
+		for (; i < cnt; i++)
+			slab_put (c, objs[i]);
+		lock_release (&c->lock);
+	}
+	return objs[0];
+}
+
+/* Obtains and returns an object from cache C for a request of SIZE
+   bytes, or returns a null pointer if memory is not available. */
+static void *
+cache_alloc (struct kmem_cache *c, size_t size) {
+	void *obj = NULL;
+
+	spinlock_acquire (&c->magazine_lock);
+	if (c->magazine_cnt > 0)
+		obj = c->magazine[--c->magazine_cnt];
+	spinlock_release (&c->magazine_lock);
+
+	if (obj == NULL) {
+		obj = magazine_reload (c);
+		if (obj == NULL)
+			return NULL;
+	}
+
+	spinlock_acquire (&c->magazine_lock);
+	c->alloc_cnt++;
+	c->requested_bytes += size;
+	spinlock_release (&c->magazine_lock);
+	return obj;
+}
+
+/* Returns OBJ to cache C.  If C's magazine is full, half of it
+   goes back to the slabs first. */
+static void
+cache_free (struct kmem_cache *c, void *obj) {
+	void *objs[MAGAZINE_SIZE / 2];
+	size_t cnt = 0, i;
+
+#ifndef NDEBUG
+	/* Clear the block to help detect use-after-free bugs, unless
+	   it has to stay constructed. */
+	if (c->ctor == NULL)
+		memset (obj, 0xcc, c->obj_size);
+#endif
+
+	spinlock_acquire (&c->magazine_lock);
+	if (c->magazine_cnt >= c->magazine_max) {
+		cnt = c->magazine_max / 2;
+		c->magazine_cnt -= cnt;
+		memcpy (objs, c->magazine + c->magazine_cnt, cnt * sizeof *objs);
+	}
+	c->magazine[c->magazine_cnt++] = obj;
+	spinlock_release (&c->magazine_lock);
+
+	if (cnt > 0) {
+		lock_acquire (&c->lock);
+		for (i = 0; i < cnt; i++)
+			slab_put (c, objs[i]);
+		lock_release (&c->lock);
+	}
 }
@@ -2,12 +2,14 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -24,13 +26,47 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool is a binary buddy allocator.  Free memory is kept in
+   blocks of 2**ORDER pages, aligned to their size relative to the
+   pool base, on one free list per order.  An allocation takes a
+   block from the smallest order that fits, splitting larger blocks
+   as needed, and gives back the pages it does not use; a free
+   merges a block with its buddy for as long as the buddy is free
+   too.  Both take O(log n) steps.  The list element of a free block
+   lives in its first page.
+
+   Pages are freed even from the scheduler, where no sleeping lock
+   can be taken, so a pool is protected by a spin lock, which also
+   keeps interrupts off while it is held.  That is short: only the
+   free list updates happen under it, never the zeroing of pages.
+
+   Each pool also keeps a stock of up to palloc_zero_target pages
+   that are already zeroed, which the idle thread refills.  A
+   single-page PAL_ZERO request takes one of those instead of
+   clearing a page itself.  Stocked pages still count as free: any
+   request that the free lists cannot satisfy returns them to the
+   free lists first. */
+
+/* Largest block order: blocks of up to 2**PALLOC_MAX_ORDER pages. */
+#define PALLOC_MAX_ORDER 10
+
+/* ORDERS entry for a page that does not start a free block. */
+#define ORDER_NONE UINT8_MAX
 
 /* A memory pool. */
 struct pool {
-	struct lock lock;               /* Mutual exclusion. */
-	struct bitmap *used_map;        /* Bitmap of free pages. */
+	struct bitmap *used_map;        /* Bitmap of allocated pages. */
+	uint8_t *orders;                /* Per page: order of the free block
+	                                   it starts, or ORDER_NONE. */
+	struct list free_lists[PALLOC_MAX_ORDER + 1];  /* Free blocks. */
 	uint8_t *base;                  /* Base of pool. */
+	size_t page_cnt;                /* Number of pages in pool. */
+	size_t free_cnt;                /* Free pages. */
+	struct list zeroed;             /* Stock of zeroed pages. */
+	size_t zeroed_cnt;              /* Number of pages in ZEROED. */
+	struct spinlock lock;           /* Protects all of the above. */
 };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -38,10 +74,20 @@ static struct pool kernel_pool, user_pool;
 
 /* Maximum number of pages to put in user pool. */
 size_t user_page_limit = SIZE_MAX;
+
+/* Number of zeroed pages the idle thread keeps in stock per pool. */
+size_t palloc_zero_target = 64;
+
+/* Single-page PAL_ZERO requests served from and not from stock. */
+static long long zeroed_hit_cnt, zeroed_miss_cnt;
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end);
 
 static bool page_from_pool (const struct pool *, void *page);
+static size_t pool_alloc (struct pool *, size_t page_cnt);
+static void pool_free (struct pool *, size_t page_idx, size_t page_cnt);
+static void *take_zeroed (struct pool *);
+static void release_zeroed (struct pool *);
 
 /* multiboot info */
 struct multiboot_info {
@@ -219,16 +265,20 @@ split:
 			else
 				NOT_REACHED ();
 
-			pool_end = pool->base + bitmap_size (pool->used_map) * PGSIZE;
+			pool_end = pool->base + pool->page_cnt * PGSIZE;
 			page_idx = pg_no (start) - pg_no (pool->base);
 			if ((uint64_t) pool_end < end) {
 				page_cnt = ((uint64_t) pool_end - start) / PGSIZE;
-				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				spinlock_acquire (&pool->lock);
+				pool_free (pool, page_idx, page_cnt);
+				spinlock_release (&pool->lock);
 				start = (uint64_t) pool_end;
 				goto split;
 			} else {
 				page_cnt = ((uint64_t) end - start) / PGSIZE;
-				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				spinlock_acquire (&pool->lock);
+				pool_free (pool, page_idx, page_cnt);
+				spinlock_release (&pool->lock);
 			}
 		}
 	}
@@ -262,12 +312,26 @@ palloc_init (void) {
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
-
-	lock_acquire (&pool->lock);
-	size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-	lock_release (&pool->lock);
+	size_t page_idx;
 	void *pages;
 
+	if (page_cnt == 0)
+		return NULL;
+
+	if (page_cnt == 1 && (flags & PAL_ZERO)) {
+		pages = take_zeroed (pool);
+		if (pages != NULL)
+			return pages;
+	}
+
+	spinlock_acquire (&pool->lock);
+	page_idx = pool_alloc (pool, page_cnt);
+	if (page_idx == BITMAP_ERROR && pool->zeroed_cnt > 0) {
+		release_zeroed (pool);
+		page_idx = pool_alloc (pool, page_cnt);
+	}
+	spinlock_release (&pool->lock);
+
 	if (page_idx != BITMAP_ERROR)
 		pages = pool->base + PGSIZE * page_idx;
 	else
@@ -318,8 +382,10 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 #ifndef NDEBUG
 	memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
+	spinlock_acquire (&pool->lock);
 	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	pool_free (pool, page_idx, page_cnt);
+	spinlock_release (&pool->lock);
 }
 
 /* Frees the page at PAGE. */
@@ -328,21 +394,119 @@ palloc_free_page (void *page) {
 	palloc_free_multiple (page, 1);
 }
 
+/* Returns the number of free pages in the user pool if PAL_USER
+   is set in FLAGS, otherwise in the kernel pool. */
+size_t
+palloc_free_cnt (enum palloc_flags flags) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	return pool->free_cnt + pool->zeroed_cnt;
+}
+
+/* Zeroes a free page for the stock of a pool that has fewer than
+   palloc_zero_target and returns true, or returns false if there is
+   nothing to do.  Called by the idle thread with interrupts off,
+   which it turns on while zeroing, so that it can be preempted. */
+bool
+palloc_zero_idle (void) {
+	struct pool *pool;
+	size_t page_idx;
+	uint8_t *page;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	/* The counts are read without the pools' locks.  A stale answer
+	   costs at most one page more or less in stock. */
+	if (kernel_pool.zeroed_cnt < palloc_zero_target
+			&& kernel_pool.free_cnt > 0)
+		pool = &kernel_pool;
+	else if (user_pool.zeroed_cnt < palloc_zero_target
+			&& user_pool.free_cnt > 0)
+		pool = &user_pool;
+	else
+		return false;
+
+	spinlock_acquire (&pool->lock);
+	page_idx = pool_alloc (pool, 1);
+	spinlock_release (&pool->lock);
+	if (page_idx == BITMAP_ERROR)
+		return false;
+	page = pool->base + page_idx * PGSIZE;
+
+	intr_enable ();
+	memset (page, 0, PGSIZE);
+	intr_disable ();
+
+	spinlock_acquire (&pool->lock);
+	list_push_front (&pool->zeroed, (struct list_elem *) page);
+	pool->zeroed_cnt++;
+	spinlock_release (&pool->lock);
+	return true;
+}
+
+/* Prints POOL's free pages by block order, and how fragmented they
+   are: the share of free pages outside the largest free block. */
+static void
+pool_print_stats (const char *name, struct pool *pool) {
+	size_t block_cnt[PALLOC_MAX_ORDER + 1];
+	size_t free_cnt, largest = 0;
+	int order;
+
+	spinlock_acquire (&pool->lock);
+	free_cnt = pool->free_cnt;
+	for (order = 0; order <= PALLOC_MAX_ORDER; order++) {
+		block_cnt[order] = list_size (&pool->free_lists[order]);
+		if (block_cnt[order] > 0)
+			largest = (size_t) 1 << order;
+	}
+	spinlock_release (&pool->lock);
+
+	printf ("%s pool: %zu of %zu pages free, largest free block %zu pages, "
+			"%zu%% fragmented, %zu zeroed\n", name, free_cnt, pool->page_cnt,
+			largest, free_cnt > 0 ? (free_cnt - largest) * 100 / free_cnt : 0,
+			pool->zeroed_cnt);
+	printf ("%s pool: free blocks by order:", name);
+	for (order = 0; order <= PALLOC_MAX_ORDER; order++)
+		printf (" %zu", block_cnt[order]);
+	printf ("\n");
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void) {
+	long long zeroed_cnt = zeroed_hit_cnt + zeroed_miss_cnt;
+
+	pool_print_stats ("Kernel", &kernel_pool);
+	pool_print_stats ("User", &user_pool);
+	printf ("Zeroed pages: %lld hits, %lld misses (%lld%% hit rate)\n",
+			zeroed_hit_cnt, zeroed_miss_cnt,
+			zeroed_cnt > 0 ? zeroed_hit_cnt * 100 / zeroed_cnt : 0);
+}
+
 /* Initializes pool P as starting at START and ending at END */
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
+  /* We'll put the pool's used_map and block orders at its base.
+     Calculate the space needed for them and subtract it from the
+     pool's size. */
 	uint64_t pgcnt = (end - start) / PGSIZE;
-	size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (pgcnt), PGSIZE) * PGSIZE;
-
-	lock_init(&p->lock);
-	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_pages);
+	size_t bm_size = bitmap_buf_size (pgcnt);
+	size_t bm_pages = DIV_ROUND_UP (bm_size + pgcnt, PGSIZE) * PGSIZE;
+	int order;
+
+	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_size);
+	p->orders = (uint8_t *) *bm_base + bm_size;
+	for (order = 0; order <= PALLOC_MAX_ORDER; order++)
+		list_init (&p->free_lists[order]);
 	p->base = (void *) start;
+	p->page_cnt = pgcnt;
+	p->free_cnt = 0;
+	list_init (&p->zeroed);
+	p->zeroed_cnt = 0;
+	spinlock_init (&p->lock);
 
 	// Mark all to unusable.
 	bitmap_set_all(p->used_map, true);
+	memset (p->orders, ORDER_NONE, pgcnt);
 
 	*bm_base += bm_pages;
 }
@@ -353,6 +517,142 @@ static bool
 page_from_pool (const struct pool *pool, void *page) {
 	size_t page_no = pg_no (page);
 	size_t start_page = pg_no (pool->base);
-	size_t end_page = start_page + bitmap_size (pool->used_map);
+	size_t end_page = start_page + pool->page_cnt;
 	return page_no >= start_page && page_no < end_page;
 }
+
+/* Returns the list element kept in the page at PAGE_IDX in POOL. */
+static struct list_elem *
+block_elem (struct pool *pool, size_t page_idx) {
+	return (struct list_elem *) (pool->base + page_idx * PGSIZE);
+}
+
+/* Returns the index of the page holding ELEM in POOL. */
+static size_t
+block_idx (struct pool *pool, struct list_elem *elem) {
+	return ((uint8_t *) elem - pool->base) / PGSIZE;
+}
+
+/* Puts the free block of 2**ORDER pages at PAGE_IDX in POOL on its
+   free list, merging it with its buddy, and the result with its
+   buddy, for as long as the buddy is free. */
+static void
+free_block (struct pool *pool, size_t page_idx, int order) {
+	while (order < PALLOC_MAX_ORDER) {
+		size_t buddy = page_idx ^ ((size_t) 1 << order);
+
+		if (buddy >= pool->page_cnt || pool->orders[buddy] != order)
+			break;
+		list_remove (block_elem (pool, buddy));
+		pool->orders[buddy] = ORDER_NONE;
+		if (buddy < page_idx)
+			page_idx = buddy;
+		order++;
+	}
+
+	pool->orders[page_idx] = order;
+	list_push_front (&pool->free_lists[order], block_elem (pool, page_idx));
+}
+
+/* Frees the PAGE_CNT pages starting at PAGE_IDX in POOL, as the
+   largest aligned blocks that cover them.  POOL's lock must be
+   held. */
+static void
+pool_free (struct pool *pool, size_t page_idx, size_t page_cnt) {
+	ASSERT (spinlock_held_by_current_cpu (&pool->lock));
+
+	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	pool->free_cnt += page_cnt;
+	while (page_cnt > 0) {
+		int order = 0;
+
+		while (order < PALLOC_MAX_ORDER
+				&& (page_idx & ((size_t) 1 << order)) == 0
+				&& ((size_t) 2 << order) <= page_cnt)
+			order++;
+		free_block (pool, page_idx, order);
+		page_idx += (size_t) 1 << order;
+		page_cnt -= (size_t) 1 << order;
+	}
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL and returns the
+   index of the first, or BITMAP_ERROR if no free block is large
+   enough.  POOL's lock must be held. */
+static size_t
+pool_alloc (struct pool *pool, size_t page_cnt) {
+	struct list_elem *e;
+	size_t page_idx;
+	int order, want;
+
+	ASSERT (spinlock_held_by_current_cpu (&pool->lock));
+
+	/* Smallest order that fits, and the smallest free block of at
+	   least that order. */
+	for (want = 0; ((size_t) 1 << want) < page_cnt; want++)
+		if (want == PALLOC_MAX_ORDER)
+			return BITMAP_ERROR;
+	for (order = want; order <= PALLOC_MAX_ORDER; order++)
+		if (!list_empty (&pool->free_lists[order]))
+			break;
+	if (order > PALLOC_MAX_ORDER)
+		return BITMAP_ERROR;
+
+	e = list_pop_front (&pool->free_lists[order]);
+	page_idx = block_idx (pool, e);
+	pool->orders[page_idx] = ORDER_NONE;
+
+	/* Split it, keeping the lower half each time. */
+	while (order > want) {
+		size_t upper;
+
+		order--;
+		upper = page_idx + ((size_t) 1 << order);
+		pool->orders[upper] = order;
+		list_push_front (&pool->free_lists[order], block_elem (pool, upper));
+	}
+
+	ASSERT (bitmap_none (pool->used_map, page_idx, (size_t) 1 << want));
+	bitmap_set_multiple (pool->used_map, page_idx, (size_t) 1 << want, true);
+	pool->free_cnt -= (size_t) 1 << want;
+
+	/* Give back what PAGE_CNT does not use. */
+	if (((size_t) 1 << want) > page_cnt)
+		pool_free (pool, page_idx + page_cnt,
+				((size_t) 1 << want) - page_cnt);
+	return page_idx;
+}
+
+/* Takes a page from POOL's stock of zeroed pages and returns it, or
+   returns a null pointer if the stock is empty. */
+static void *
+take_zeroed (struct pool *pool) {
+	struct list_elem *e = NULL;
+
+	spinlock_acquire (&pool->lock);
+	if (!list_empty (&pool->zeroed)) {
+		e = list_pop_front (&pool->zeroed);
+		pool->zeroed_cnt--;
+		zeroed_hit_cnt++;
+	} else
+		zeroed_miss_cnt++;
+	spinlock_release (&pool->lock);
+
+	/* The list element was the only thing in the page. */
+	if (e != NULL)
+		memset (e, 0, sizeof *e);
+	return e;
+}
+
+/* Puts every page of POOL's zeroed stock back on its free lists.
+   POOL's lock must be held. */
+static void
+release_zeroed (struct pool *pool) {
+	ASSERT (spinlock_held_by_current_cpu (&pool->lock));
+
+	while (!list_empty (&pool->zeroed)) {
+		struct list_elem *e = list_pop_front (&pool->zeroed);
+		pool_free (pool, block_idx (pool, e), 1);
+	}
+	pool->zeroed_cnt = 0;
+}
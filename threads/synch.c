@@ -32,6 +32,8 @@
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
+static void refresh_priority (struct thread *);
+
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
    manipulating it:
@@ -229,7 +231,7 @@ lock_acquire (struct lock *lock) {
                 /* Maximum nested depth is 8 */
                 for (int i = 1; i <= 8; i++) {
                     if (thread_current()->priority > next_thread->priority)
-                        next_thread->priority = thread_current()->priority;
+                        thread_change_priority(next_thread, thread_current()->priority);
 
                     if (next_thread->lock_on_waiting != NULL)
                         next_thread = next_thread->lock_on_waiting->holder;
@@ -279,6 +281,8 @@ lock_try_acquire (struct lock *lock) {
    handler. */
 void
 lock_release (struct lock *lock) {
+	enum intr_level old_level;
+
 	ASSERT (lock != NULL);
 	ASSERT (lock_held_by_current_thread (lock));
 
@@ -300,24 +304,12 @@ lock_release (struct lock *lock) {
                 else
                     current_list_elem = list_next(current_list_elem);
             }
-
-            /* Reset priority due to lock release */
-            thread_current()->priority = thread_current()->original_priority;
-
-            if (!list_empty(&thread_current()->list_donated_threads)) {
-
-                current_list_elem = list_begin(&thread_current()->list_donated_threads);
-
-                while (current_list_elem != list_end(&thread_current()->list_donated_threads)) {
-                    struct thread *target_thread = list_entry(current_list_elem,
-                    struct thread, elem_for_donation);
-                    if (thread_current()->priority < target_thread->priority)
-                        thread_current()->priority = target_thread->priority;
-
-                    current_list_elem = list_next(current_list_elem);
-                }
-            }
         }
+
+        /* Reset priority due to lock release */
+        old_level = intr_disable ();
+        refresh_priority (thread_current ());
+        intr_set_level (old_level);
     }
 
     lock->holder = NULL;
@@ -439,3 +431,350 @@ cond_broadcast (struct condition *cond, struct lock *lock) {
 	while (!list_empty (&cond->waiters))
 		cond_signal (cond, lock);
 }
+
+/* Initializes RW, a reader-writer lock.  Any number of threads
+   may hold it for reading at once, or a single thread for
+   writing.
+
+   A writer holds RW->LOCK for as long as it writes, so writers
+   queue on that lock in priority order and donate to the one
+   holding it like on any other lock.  A reader holds RW->LOCK
+   only while it enters, then records itself on RW->READERS.  A
+   writer that finds readers keeps RW->LOCK and sleeps until the
+   last of them leaves; meanwhile new readers queue behind it on
+   RW->LOCK.  So writers are preferred and cannot starve.
+
+   While a writer waits for readers, it donates its priority to
+   each of them, and so does every thread that queues behind it.
+   A reader drops what it was donated when it leaves.
+
+   A thread that already holds RW may take it for reading again,
+   even past a waiting writer; otherwise a nested read could
+   deadlock against that writer.  A read nested in a write is part
+   of the write hold, which lasts until both are released.  A
+   thread has room to record RWLOCK_HOLD_MAX read holds; past that,
+   it takes RW for writing instead, which excludes everyone a read
+   would, only more.  RW cannot be upgraded from reading to
+   writing. */
+void
+rwlock_init (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+
+	lock_init (&rw->lock);
+	list_init (&rw->readers);
+	rw->writing = false;
+	rw->write_depth = 0;
+	rw->draining = NULL;
+	sema_init (&rw->drained, 0);
+}
+
+/* Returns T's read hold on RW, or a null pointer. */
+static struct rwlock_hold *
+rwlock_find_hold (struct thread *t, const struct rwlock *rw) {
+	for (int i = 0; i < RWLOCK_HOLD_MAX; i++)
+		if (t->read_holds[i].rwlock == rw)
+			return &t->read_holds[i];
+	return NULL;
+}
+
+/* Raises every reader of RW to at least PRIORITY, and whatever they
+   in turn wait on, as lock_acquire() does for a lock holder.
+   Interrupts must be off. */
+static void
+rwlock_donate (struct rwlock *rw, int priority) {
+	struct list_elem *e;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (thread_mlfqs)
+		return;
+
+	for (e = list_begin (&rw->readers); e != list_end (&rw->readers);
+			e = list_next (e)) {
+		struct thread *t = list_entry (e, struct rwlock_hold, elem)->thread;
+
+		for (int depth = 0; t != NULL && depth < 8; depth++) {
+			if (t->priority < priority)
+				thread_change_priority (t, priority);
+			if (t->lock_on_waiting == NULL)
+				break;
+			t = t->lock_on_waiting->holder;
+		}
+	}
+}
+
+/* Recomputes the priority of T, which just released a lock or
+   reader-writer lock, from its own priority and what it is still
+   donated: by the threads waiting on locks it holds, and by the
+   writers waiting for it to leave reader-writer locks it reads.
+   Interrupts must be off. */
+static void
+refresh_priority (struct thread *t) {
+	int priority = t->original_priority;
+	struct list_elem *e;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (thread_mlfqs)
+		return;
+
+	for (e = list_begin (&t->list_donated_threads);
+			e != list_end (&t->list_donated_threads); e = list_next (e)) {
+		struct thread *donor = list_entry (e, struct thread, elem_for_donation);
+		if (donor->priority > priority)
+			priority = donor->priority;
+	}
+	for (int i = 0; i < RWLOCK_HOLD_MAX; i++) {
+		struct rwlock *rw = t->read_holds[i].rwlock;
+		if (rw != NULL && rw->draining != NULL
+				&& rw->draining->priority > priority)
+			priority = rw->draining->priority;
+	}
+	thread_change_priority (t, priority);
+}
+
+/* Records the current thread as a reader of RW, whose LOCK it
+   holds, in a read hold it has checked is free. */
+static void
+rwlock_add_reader (struct rwlock *rw) {
+	struct thread *cur = thread_current ();
+	struct rwlock_hold *hold = rwlock_find_hold (cur, NULL);
+	enum intr_level old_level;
+
+	ASSERT (hold != NULL);
+
+	hold->thread = cur;
+	hold->depth = 1;
+	old_level = intr_disable ();
+	hold->rwlock = rw;
+	list_push_back (&rw->readers, &hold->elem);
+	intr_set_level (old_level);
+}
+
+/* Acquires RW for reading, sleeping until no writer holds it or
+   waits for it, unless the current thread already holds it for
+   reading.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_read (struct rwlock *rw) {
+	struct rwlock_hold *hold;
+	enum intr_level old_level;
+
+	ASSERT (rw != NULL);
+	ASSERT (!intr_context ());
+
+	if (rwlock_held_for_write (rw)) {
+		rw->write_depth++;
+		return;
+	}
+	hold = rwlock_find_hold (thread_current (), rw);
+	if (hold != NULL) {
+		hold->depth++;
+		return;
+	}
+	if (rwlock_find_hold (thread_current (), NULL) == NULL) {
+		rwlock_acquire_write (rw);
+		return;
+	}
+
+	/* A writer waiting for readers cannot pass our priority on. */
+	old_level = intr_disable ();
+	if (rw->draining != NULL)
+		rwlock_donate (rw, thread_get_priority ());
+	intr_set_level (old_level);
+
+	lock_acquire (&rw->lock);
+	rwlock_add_reader (rw);
+	lock_release (&rw->lock);
+}
+
+/* Tries to acquire RW for reading without sleeping.  Returns true
+   if successful, false if a writer holds RW or is entering it. */
+bool
+rwlock_try_acquire_read (struct rwlock *rw) {
+	struct rwlock_hold *hold;
+
+	ASSERT (rw != NULL);
+
+	if (rwlock_held_for_write (rw)) {
+		rw->write_depth++;
+		return true;
+	}
+	hold = rwlock_find_hold (thread_current (), rw);
+	if (hold != NULL) {
+		hold->depth++;
+		return true;
+	}
+	if (rwlock_find_hold (thread_current (), NULL) == NULL)
+		return rwlock_try_acquire_write (rw);
+
+	if (!lock_try_acquire (&rw->lock))
+		return false;
+	rwlock_add_reader (rw);
+	lock_release (&rw->lock);
+	return true;
+}
+
+/* Releases RW, which the current thread must have acquired for
+   reading.  The last reader to leave wakes a waiting writer. */
+void
+rwlock_release_read (struct rwlock *rw) {
+	struct thread *cur = thread_current ();
+	struct rwlock_hold *hold;
+	enum intr_level old_level;
+
+	ASSERT (rw != NULL);
+
+	hold = rwlock_find_hold (cur, rw);
+	if (hold == NULL) {
+		/* Part of a write hold. */
+		rwlock_release_write (rw);
+		return;
+	}
+	if (--hold->depth > 0)
+		return;
+
+	old_level = intr_disable ();
+	list_remove (&hold->elem);
+	hold->rwlock = NULL;
+	refresh_priority (cur);
+	if (list_empty (&rw->readers) && rw->draining != NULL)
+		sema_up (&rw->drained);
+	else
+		yield_if_max_priority ();
+	intr_set_level (old_level);
+}
+
+/* Acquires RW for writing, sleeping until no other thread holds it.
+   The current thread must not hold RW at all.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_write (struct rwlock *rw) {
+	enum intr_level old_level;
+
+	ASSERT (rw != NULL);
+	ASSERT (!intr_context ());
+	ASSERT (!rwlock_held_for_read (rw));
+
+	old_level = intr_disable ();
+	if (rw->draining != NULL)
+		rwlock_donate (rw, thread_get_priority ());
+	intr_set_level (old_level);
+
+	lock_acquire (&rw->lock);
+
+	old_level = intr_disable ();
+	while (!list_empty (&rw->readers)) {
+		rw->draining = thread_current ();
+		rwlock_donate (rw, thread_get_priority ());
+		sema_down (&rw->drained);
+	}
+	rw->draining = NULL;
+	intr_set_level (old_level);
+
+	rw->writing = true;
+	rw->write_depth = 1;
+}
+
+/* Tries to acquire RW for writing without sleeping.  Returns true
+   if successful, false if any other thread holds RW. */
+bool
+rwlock_try_acquire_write (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+	ASSERT (!rwlock_held_for_read (rw));
+
+	if (!lock_try_acquire (&rw->lock))
+		return false;
+	if (!list_empty (&rw->readers)) {
+		lock_release (&rw->lock);
+		return false;
+	}
+	rw->writing = true;
+	rw->write_depth = 1;
+	return true;
+}
+
+/* Releases RW, which the current thread must hold for writing.
+   RW stays held until the reads nested in the write are released
+   too. */
+void
+rwlock_release_write (struct rwlock *rw) {
+	ASSERT (rwlock_held_for_write (rw));
+
+	if (--rw->write_depth > 0)
+		return;
+	rw->writing = false;
+	lock_release (&rw->lock);
+}
+
+/* Returns true if the current thread holds RW for reading. */
+bool
+rwlock_held_for_read (const struct rwlock *rw) {
+	ASSERT (rw != NULL);
+
+	return rwlock_find_hold (thread_current (), rw) != NULL;
+}
+
+/* Returns true if the current thread holds RW for writing. */
+bool
+rwlock_held_for_write (const struct rwlock *rw) {
+	ASSERT (rw != NULL);
+
+	return rw->writing && lock_held_by_current_thread (&rw->lock);
+}
+
+/* Initializes LOCK, which is not held. */
+void
+spinlock_init (struct spinlock *lock) {
+	ASSERT (lock != NULL);
+
+	lock->locked = 0;
+	lock->holder = NULL;
+}
+
+/* Acquires LOCK, spinning until it is free.  Interrupts are off on
+   this CPU from now until LOCK is released.  LOCK must not already
+   be held by this CPU.
+
+   This function never sleeps, so it may be called with interrupts
+   off or within an interrupt handler. */
+void
+spinlock_acquire (struct spinlock *lock) {
+	enum intr_level old_level;
+
+	ASSERT (lock != NULL);
+
+	old_level = intr_disable ();
+	ASSERT (!spinlock_held_by_current_cpu (lock));
+	while (__atomic_exchange_n (&lock->locked, 1, __ATOMIC_ACQUIRE))
+		while (lock->locked)
+			asm volatile ("pause");
+	lock->holder = this_cpu ();
+	lock->old_level = old_level;
+}
+
+/* Releases LOCK, which must be held by this CPU, and restores the
+   interrupt level from before it was acquired. */
+void
+spinlock_release (struct spinlock *lock) {
+	enum intr_level old_level;
+
+	ASSERT (spinlock_held_by_current_cpu (lock));
+
+	old_level = lock->old_level;
+	lock->holder = NULL;
+	__atomic_store_n (&lock->locked, 0, __ATOMIC_RELEASE);
+	intr_set_level (old_level);
+}
+
+/* Returns true if this CPU holds LOCK, false otherwise. */
+bool
+spinlock_held_by_current_cpu (const struct spinlock *lock) {
+	ASSERT (lock != NULL);
+
+	return lock->locked && lock->holder == this_cpu ();
+}
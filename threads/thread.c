@@ -32,13 +32,37 @@
  * of an integer as representing a fraction, 17.14 fixed-point number representation */
 #define FRACTION 16384
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Processes in THREAD_READY state, that is, processes that are
+   ready to run but not actually running.  There is one FIFO queue
+   per priority level, and bit N of ready_bitmap is set whenever
+   ready_queues[N] is non-empty, so the highest ready priority is a
+   single find-last-set. */
+static struct list ready_queues[PRI_MAX + 1];
+static uint64_t ready_bitmap;
+static size_t ready_threads;            /* # of threads in ready_queues. */
+#if PRI_MAX - PRI_MIN >= 64
+#error ready_bitmap requires at most 64 priority levels
+#endif
 
 /* List of all threads for mlfqs scheduling */
 static struct list thread_pool;
 
+/* Per-CPU state. */
+struct cpu cpus[CPU_MAX];
+
+/* Last decay epoch for which every ready thread's priority was
+   recalculated. */
+static int64_t refreshed_epoch;
+
+/* The once-per-second recent_cpu decay is applied lazily.  Each
+   second advances decay_epoch and records that second's decay
+   coefficient, and a thread catches up on the decays it missed
+   the next time it is examined.  Only the last DECAY_HISTORY
+   coefficients are remembered. */
+#define DECAY_HISTORY 256
+static int64_t decay_epoch;
+static int decay_coefficients[DECAY_HISTORY];
+
 /* Load Average */
 int load_avg;
 
@@ -48,12 +72,26 @@ static struct thread *idle_thread;
 /* Initial thread, the thread running init.c:main(). */
 static struct thread *initial_thread;
 
-/* Lock used by allocate_tid(). */
-static struct lock tid_lock;
+/* Next tid to hand out, advanced atomically by allocate_tid(). */
+static tid_t next_tid = 1;
 
 /* Thread destruction requests */
 static struct list destruction_req;
 
+/* Pages and file descriptor tables of dead threads, kept for new
+   threads so that creating one does not go to the page allocator
+   or clear a page it is about to overwrite.  Only the `struct
+   thread' at the base of a page is reinitialized; a file
+   descriptor table is recycled only once every descriptor in it is
+   closed, so all of its entries are already null.  Guarded by
+   turning interrupts off, since dead threads are reaped in the
+   scheduler. */
+#define THREAD_CACHE_MAX 16
+static struct thread *free_threads[THREAD_CACHE_MAX];
+static size_t free_thread_cnt;
+static struct file **free_fdts[THREAD_CACHE_MAX];
+static size_t free_fdt_cnt;
+
 /* Returns true if priority of thread a is less than priority of thread b, false
    otherwise. */
 bool
@@ -87,6 +125,15 @@ static void init_thread (struct thread *, const char *name, int priority);
 static void do_schedule(int status);
 static void schedule (void);
 static tid_t allocate_tid (void);
+static struct thread *thread_page_get (void);
+static struct file **fdt_get (void);
+static void thread_release (struct thread *);
+static void ready_queue_push (struct thread *);
+static void ready_queue_remove (struct thread *);
+static struct thread *ready_queue_pop (void);
+static int ready_queue_max_priority (void);
+static void mlfqs_decay (struct thread *);
+static void mlfqs_refresh (struct thread *);
 
 /* Returns true if T appears to point to a valid thread. */
 #define is_thread(t) ((t) != NULL && (t)->magic == THREAD_MAGIC)
@@ -133,8 +180,10 @@ thread_init (void) {
 	lgdt (&gdt_ds);
 
 	/* Init the global thread context */
-	lock_init (&tid_lock);
-	list_init (&ready_list);
+	for (int pri = PRI_MIN; pri <= PRI_MAX; pri++)
+		list_init (&ready_queues[pri]);
+	ready_bitmap = 0;
+	ready_threads = 0;
 	list_init (&destruction_req);
     list_init (&thread_pool);
 
@@ -142,6 +191,7 @@ thread_init (void) {
 	initial_thread = running_thread ();
 	init_thread (initial_thread, "main", PRI_DEFAULT);
 	initial_thread->status = THREAD_RUNNING;
+	this_cpu ()->current = initial_thread;
     initial_thread->tid = allocate_tid ();
 
 }
@@ -171,36 +221,58 @@ mlfqs_priority (int recent_cpu, int nice) {
 	int temp, priority;
 	temp = (recent_cpu / -4) + (PRI_MAX - (nice * 2)) * FRACTION;
 
-	if (thread_current() == idle_thread) 
-		return thread_current()->priority;
-	else {
-		if (temp >= 0)
-            priority = (temp + FRACTION / 2) / FRACTION;
-        else
-            priority = (temp - FRACTION / 2) / FRACTION;
-
-        if (priority > PRI_MAX)
-            priority = PRI_MAX;
-        else if (priority < PRI_MIN)
-            priority = PRI_MIN;
-
-        return priority;
-	}
+	if (temp >= 0)
+        priority = (temp + FRACTION / 2) / FRACTION;
+    else
+        priority = (temp - FRACTION / 2) / FRACTION;
+
+    if (priority > PRI_MAX)
+        priority = PRI_MAX;
+    else if (priority < PRI_MIN)
+        priority = PRI_MIN;
 
+    return priority;
 }
 
+/* Returns the decay coefficient (2 * load_avg) / (2 * load_avg + 1)
+   for the current load_avg. */
+static int
+mlfqs_coefficient (void) {
+	return (((int64_t)(2 * load_avg)) * FRACTION) / (2 * load_avg + 1 * FRACTION);
+}
 
 int
 mlfqs_recent_cpu (int recent_cpu, int nice) {
-    int coefficient;
+	return ((((int64_t) mlfqs_coefficient ()) * recent_cpu) / FRACTION) + nice * FRACTION;
+}
 
-	if (thread_current() == idle_thread) 
-		return thread_current()->recent_cpu;
-	else {
-		coefficient = (((int64_t)(2 * load_avg)) * FRACTION) / (2 * load_avg + 1 * FRACTION);
-		return ((((int64_t) coefficient) * recent_cpu) / FRACTION) + nice * FRACTION;
+/* Applies to T the per-second recent_cpu decays it has missed
+   since it was last examined.  A thread that slept through more
+   than DECAY_HISTORY seconds only gets the most recent ones. */
+static void
+mlfqs_decay (struct thread *t) {
+	int64_t epoch = t->decayed_epoch;
+
+	if (decay_epoch - epoch > DECAY_HISTORY)
+		epoch = decay_epoch - DECAY_HISTORY;
+
+	while (epoch < decay_epoch) {
+		int coefficient = decay_coefficients[++epoch % DECAY_HISTORY];
+		t->recent_cpu = ((((int64_t) coefficient) * t->recent_cpu) / FRACTION)
+			+ t->nice * FRACTION;
 	}
-    
+	t->decayed_epoch = decay_epoch;
+}
+
+/* Brings T's recent_cpu up to date and recalculates its priority,
+   moving it between ready queues if necessary. */
+static void
+mlfqs_refresh (struct thread *t) {
+	if (t == idle_thread)
+		return;
+
+	mlfqs_decay (t);
+	thread_change_priority (t, mlfqs_priority (t->recent_cpu, t->nice));
 }
 
 void
@@ -209,9 +281,9 @@ mlfqs_load_avg (void) {
      * to run at time of update (not including the idle thread).*/
     int n_threads;
 	if (thread_current() == idle_thread) 
-		n_threads = list_size(&ready_list);
+		n_threads = ready_threads;
 	else 
-		n_threads = list_size(&ready_list) + 1;
+		n_threads = ready_threads + 1;
 
 	load_avg = (((int64_t)((int64_t)(59 * FRACTION) * FRACTION / (60 * FRACTION))) * load_avg / FRACTION) 
 				+ ((((int64_t)(1 * FRACTION)) * FRACTION / (60 * FRACTION)) * n_threads);
@@ -219,41 +291,65 @@ mlfqs_load_avg (void) {
 
 void 
 mlfqs_increment_cpu (void) {
-    if (thread_current() != idle_thread)
+    /* Catch up on missed decays before the tick is added, so the
+       tick is not decayed along with them. */
+    if (thread_current() != idle_thread) {
+        mlfqs_decay (thread_current());
         thread_current()->recent_cpu = thread_current()->recent_cpu + 1 * FRACTION;
+    }
 }
 
+/* Starts a new decay epoch using the current load_avg.  Only the
+   running thread is decayed right away; every other thread catches
+   up in mlfqs_decay() when it is next examined. */
 void 
 mlfqs_recalculate_cpu (void) {
-	struct list_elem* current_list_elem;
+	decay_epoch++;
+	decay_coefficients[decay_epoch % DECAY_HISTORY] = mlfqs_coefficient ();
+
+	if (thread_current() != idle_thread)
+		mlfqs_decay (thread_current());
+}
 
-	if (!list_empty(&thread_pool)) {
-		current_list_elem = list_begin(&thread_pool);
+/* Recalculates the priority of every ready thread.  The ready
+   queues are drained in priority order and refilled, so threads
+   whose priority does not change keep their round-robin order. */
+static void
+mlfqs_refresh_ready (void) {
+	struct list ready;
 
-		while (current_list_elem != list_end(&thread_pool)) {
-			struct thread *target_thread = list_entry (current_list_elem, struct thread, elem_for_pool);
-			target_thread->recent_cpu = mlfqs_recent_cpu(target_thread->recent_cpu, target_thread->nice);
-			current_list_elem = list_next(current_list_elem);
-		}
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	list_init (&ready);
+	for (int pri = PRI_MAX; pri >= PRI_MIN; pri--)
+		while (!list_empty (&ready_queues[pri]))
+			list_push_back (&ready, list_pop_front (&ready_queues[pri]));
+	ready_bitmap = 0;
+	ready_threads = 0;
+
+	while (!list_empty (&ready)) {
+		struct thread *t = list_entry (list_pop_front (&ready),
+				struct thread, elem);
+
+		mlfqs_decay (t);
+		t->priority = mlfqs_priority (t->recent_cpu, t->nice);
+		ready_queue_push (t);
 	}
 }
 
+/* Recalculates the priority of the running thread, and of every
+   ready thread once per decay epoch.  A ready thread earns no
+   recent_cpu and cannot change its nice value, so between epochs
+   its priority cannot change; blocked threads are refreshed in
+   thread_unblock() and never cost anything here. */
 void 
 mlfqs_recalculate_priority (void) {
-	struct list_elem* current_list_elem;
-
-	if (!list_empty(&thread_pool)) {
-		current_list_elem = list_begin(&thread_pool);
+	mlfqs_refresh (thread_current());
 
-		while (current_list_elem != list_end(&thread_pool)) {
-			struct thread *target_thread = list_entry (current_list_elem, struct thread, elem_for_pool);
-			target_thread->priority = mlfqs_priority(target_thread->recent_cpu, target_thread->nice);
-			current_list_elem = list_next(current_list_elem);
-		}
+	if (refreshed_epoch != decay_epoch) {
+		refreshed_epoch = decay_epoch;
+		mlfqs_refresh_ready ();
 	}
-
-	if (!list_empty(&ready_list))
-		list_sort (&ready_list, priority_less, NULL);
 }
 
 
@@ -309,18 +405,21 @@ thread_create (const char *name, int priority,
 
 	ASSERT (function != NULL);
 
-	/* Allocate thread. */
-	t = palloc_get_page (PAL_ZERO);
-	if (t == NULL)
+	/* Allocate thread and its file descriptor table. */
+	struct file **fdt = fdt_get ();
+	if (fdt == NULL)
+		return TID_ERROR;
+	t = thread_page_get ();
+	if (t == NULL) {
+		palloc_free_multiple (fdt, N_FDT);
 		return TID_ERROR;
+	}
 
     /* Initialize thread. */
 	init_thread (t, name, priority);
 
     /* File descriptor. */
-    t->file_descriptor_table = palloc_get_multiple(PAL_ZERO, N_FDT);
-    if (t->file_descriptor_table == NULL)
-        return TID_ERROR;
+    t->file_descriptor_table = fdt;
 
     /* Initialize index as 2. (STDIN, STDOUT) */
     t->file_descriptor_index = 2;
@@ -401,10 +500,12 @@ thread_unblock (struct thread *t) {
 
 	old_level = intr_disable ();
 	ASSERT (t->status == THREAD_BLOCKED);
-    /* Unblocked thread should be pushed to ready list .
-     * Then sort the threads in ready list ascending order of priority */
-    list_push_front (&ready_list, &t->elem);
-    list_sort (&ready_list, priority_less, NULL);
+    /* A thread that slept through decay epochs has a stale priority. */
+    if (thread_mlfqs)
+        mlfqs_refresh (t);
+
+    /* Unblocked thread goes to the back of its priority's ready queue. */
+    ready_queue_push (t);
 
     t->status = THREAD_READY;
     intr_set_level (old_level);
@@ -417,11 +518,16 @@ thread_name (void) {
 }
 
 /* Returns the running thread.
-   This is running_thread() plus a couple of sanity checks.
-   See the big comment at the top of thread.h for details. */
+   This is the current thread of this CPU, as schedule() records
+   it, plus a couple of sanity checks.  Unlike running_thread(), it
+   does not depend on the stack pointer, so it stays right with a
+   thread on each CPU.  See the big comment at the top of thread.h
+   for details. */
 struct thread *
 thread_current (void) {
-	struct thread *t = running_thread ();
+	enum intr_level old_level = intr_disable ();
+	struct thread *t = this_cpu ()->current;
+	intr_set_level (old_level);
 
 	/* Make sure T is really a thread.
 	   If either of these assertions fire, then your thread may
@@ -472,10 +578,9 @@ thread_yield (void) {
     old_level = intr_disable();
 
     if (curr != idle_thread) {
-        /* Thread that was currently running should be pushed back to ready list .
-         * Then sort the threads in ready list ascending order of priority */
-        list_push_front(&ready_list, &curr->elem);
-        list_sort(&ready_list, priority_less, NULL);
+        /* Thread that was currently running goes to the back of its
+         * priority's ready queue, behind threads of equal priority. */
+        ready_queue_push (curr);
     }
 
 	do_schedule (THREAD_READY);
@@ -485,8 +590,6 @@ thread_yield (void) {
 /* Sets the current thread's priority to NEW_PRIORITY. */
 void
 thread_set_priority (int new_priority) {
-    struct list_elem* current_list_elem;
-
 	if (thread_mlfqs) return;
     else {
         thread_current()->original_priority = new_priority;
@@ -494,22 +597,35 @@ thread_set_priority (int new_priority) {
             thread_current()->priority = thread_current()->original_priority;
 
         /* If there is any thread that has higher priority than new_priority, Yield */
-        if (!list_empty(&ready_list)) {
-            current_list_elem = list_begin(&ready_list);
-
-            while (current_list_elem != list_end(&ready_list)) {
-                struct thread *target_thread = list_entry (current_list_elem, struct thread, elem);
-                if (new_priority < target_thread->priority) {
-                    thread_yield();
-                    break;
-                }
-                current_list_elem = list_next(current_list_elem);
-            }
-        }
+        if (new_priority < ready_queue_max_priority ())
+            thread_yield();
     }
 
 }
 
+/* Changes T's effective priority to NEW_PRIORITY.  If T is
+   waiting in a ready queue, it is moved to the back of the queue
+   for its new priority so that next_thread_to_run() sees it.
+   Used by priority donation and by the MLFQS recalculation. */
+void
+thread_change_priority (struct thread *t, int new_priority) {
+	enum intr_level old_level;
+
+	ASSERT (is_thread (t));
+	ASSERT (PRI_MIN <= new_priority && new_priority <= PRI_MAX);
+
+	old_level = intr_disable ();
+	if (t->priority != new_priority) {
+		if (t->status == THREAD_READY) {
+			ready_queue_remove (t);
+			t->priority = new_priority;
+			ready_queue_push (t);
+		} else
+			t->priority = new_priority;
+	}
+	intr_set_level (old_level);
+}
+
 /* Returns the current thread's priority. */
 int
 thread_get_priority (void) {
@@ -519,19 +635,15 @@ thread_get_priority (void) {
 /* Sets the current thread's nice value to NICE. */
 void
 thread_set_nice (int nice) {
+	/* Missed decays use the old nice value; then recalculate the
+	   thread's priority based on the new value. */
+	mlfqs_decay (thread_current());
 	thread_current()->nice = nice;
-
-	/* Recalculate the thread's priority based on the new value. */
-    thread_current()->recent_cpu = mlfqs_recent_cpu(thread_current()->recent_cpu, nice);
 	thread_current()->priority = mlfqs_priority(thread_current()->recent_cpu, nice);
 
 	/* If there is any thread that has higher priority than new_priority, Yield */
-	if (!list_empty(&ready_list)) {
-        list_sort (&ready_list, priority_less, NULL);
-
-		if (thread_current()->priority < list_entry(list_back(&ready_list), struct thread, elem)->priority)
-			thread_yield();
-	}
+	if (thread_current()->priority < ready_queue_max_priority ())
+		thread_yield();
 }
 
 /* Returns the current thread's nice value. */
@@ -568,6 +680,7 @@ int
 thread_get_recent_cpu (void) {
     int temp, cpu;
 
+    mlfqs_decay (thread_current());
     temp = thread_current()->recent_cpu * 100;
 
     if (temp >= 0)
@@ -599,6 +712,11 @@ idle (void *idle_started_ UNUSED) {
 		intr_disable ();
 		thread_block ();
 
+		/* With nothing else to run, zero a page for PAL_ZERO
+		   allocations, then check again for other work. */
+		if (palloc_zero_idle ())
+			continue;
+
 		/* Re-enable interrupts and wait for the next one.
 
 		   The `sti' instruction disables interrupts until the
@@ -643,6 +761,7 @@ init_thread (struct thread *t, const char *name, int priority) {
 	// ** initialize nice, recent_cpu
 	t->nice = 0;
 	t->recent_cpu = 0;
+	t->decayed_epoch = decay_epoch;
 
     /* Store original priority of the thread due to priority donation */
     t->original_priority = priority;
@@ -672,12 +791,64 @@ init_thread (struct thread *t, const char *name, int priority) {
    idle_thread. */
 static struct thread *
 next_thread_to_run (void) {
-	if (list_empty (&ready_list))
+	struct thread *next;
+
+	if (ready_bitmap == 0)
 		return idle_thread;
-	else
-        /* Since ready list is sorted ascending order of priority,
-         * pop next thread from the back of ready list which has the highest priority */
-		return list_entry (list_pop_back (&ready_list), struct thread, elem);
+
+	/* A thread that waited through decay epochs catches up before
+	   it runs and starts earning recent_cpu again. */
+	next = ready_queue_pop ();
+	if (thread_mlfqs)
+		mlfqs_decay (next);
+	return next;
+}
+
+/* Appends T to the ready queue for T's priority.
+   Interrupts must be off. */
+static void
+ready_queue_push (struct thread *t) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	list_push_back (&ready_queues[t->priority], &t->elem);
+	ready_bitmap |= 1ULL << t->priority;
+	ready_threads++;
+}
+
+/* Removes T from the ready queue for T's priority.
+   Interrupts must be off. */
+static void
+ready_queue_remove (struct thread *t) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (t->status == THREAD_READY);
+
+	list_remove (&t->elem);
+	if (list_empty (&ready_queues[t->priority]))
+		ready_bitmap &= ~(1ULL << t->priority);
+	ready_threads--;
+}
+
+/* Removes and returns the oldest thread of the highest non-empty
+   priority.  At least one thread must be ready. */
+static struct thread *
+ready_queue_pop (void) {
+	struct thread *t;
+
+	ASSERT (ready_bitmap != 0);
+
+	t = list_entry (list_front (&ready_queues[ready_queue_max_priority ()]),
+			struct thread, elem);
+	ready_queue_remove (t);
+	return t;
+}
+
+/* Returns the highest priority of any ready thread, or -1 if no
+   thread is ready. */
+static int
+ready_queue_max_priority (void) {
+	if (ready_bitmap == 0)
+		return -1;
+	return 63 - __builtin_clzll (ready_bitmap);
 }
 
 /* Use iretq to launch the thread */
@@ -788,7 +959,7 @@ do_schedule(int status) {
 	while (!list_empty (&destruction_req)) {
 		struct thread *victim =
 			list_entry (list_pop_front (&destruction_req), struct thread, elem);
-		palloc_free_page(victim);
+		thread_release (victim);
 	}
 	thread_current ()->status = status;
 	schedule ();
@@ -804,6 +975,7 @@ schedule (void) {
 	ASSERT (is_thread (next));
 	/* Mark us as running. */
 	next->status = THREAD_RUNNING;
+	this_cpu ()->current = next;
 
 	/* Start new time slice. */
 	thread_ticks = 0;
@@ -835,29 +1007,77 @@ schedule (void) {
 /* Returns a tid to use for a new thread. */
 static tid_t
 allocate_tid (void) {
-	static tid_t next_tid = 1;
-	tid_t tid;
+	return __atomic_fetch_add (&next_tid, 1, __ATOMIC_RELAXED);
+}
 
-	lock_acquire (&tid_lock);
-	tid = next_tid++;
-	lock_release (&tid_lock);
+/* Returns a page for a new thread, recycled if possible.  Its
+   contents are garbage; init_thread() sets up the `struct thread'
+   and the rest is stack.  Returns a null pointer if no page is
+   available. */
+static struct thread *
+thread_page_get (void) {
+	struct thread *t = NULL;
+	enum intr_level old_level;
 
-	return tid;
+	old_level = intr_disable ();
+	if (free_thread_cnt > 0)
+		t = free_threads[--free_thread_cnt];
+	intr_set_level (old_level);
+
+	return t != NULL ? t : palloc_get_page (0);
+}
+
+/* Returns a file descriptor table for a new thread, recycled if
+   possible, with every entry null.  Returns a null pointer if no
+   pages are available. */
+static struct file **
+fdt_get (void) {
+	struct file **fdt = NULL;
+	enum intr_level old_level;
+
+	old_level = intr_disable ();
+	if (free_fdt_cnt > 0)
+		fdt = free_fdts[--free_fdt_cnt];
+	intr_set_level (old_level);
+
+	return fdt != NULL ? fdt : palloc_get_multiple (PAL_ZERO, N_FDT);
+}
+
+/* Frees dead thread T's page and file descriptor table, or keeps
+   them for new threads.  Called by the scheduler with interrupts
+   off. */
+static void
+thread_release (struct thread *t) {
+	struct file **fdt = t->file_descriptor_table;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (fdt != NULL) {
+		/* Only the standard input and output entries may be set,
+		   by thread_create() itself. */
+		fdt[0] = fdt[1] = NULL;
+		if (free_fdt_cnt < THREAD_CACHE_MAX)
+			free_fdts[free_fdt_cnt++] = fdt;
+		else
+			palloc_free_multiple (fdt, N_FDT);
+	}
+
+	if (free_thread_cnt < THREAD_CACHE_MAX)
+		free_threads[free_thread_cnt++] = t;
+	else
+		palloc_free_page (t);
 }
 
 
 void yield_if_max_priority(void){
     struct thread* current_thread;
-    struct thread* max_priority_thread;
 
     current_thread = thread_current();
 
     /* If interrupt isn't available or no thread is waiting. */
-    if(intr_context() || list_empty(&ready_list))
+    if(intr_context() || ready_bitmap == 0)
         return;
 
-    max_priority_thread = list_entry(list_back(&ready_list), struct thread, elem);
-
-    if(max_priority_thread->priority > current_thread->priority)
+    if(ready_queue_max_priority () > current_thread->priority)
         thread_yield();
 }
@@ -139,16 +139,24 @@ page_fault (struct intr_frame *f) {
 	write = (f->error_code & PF_W) != 0;
 	user = (f->error_code & PF_U) != 0;
 
+	/* Count page faults. */
+	page_fault_cnt++;
+
 #ifdef VM
 	/* For project 3 and later. */
 	if (vm_try_handle_fault (f, fault_addr, user, write, not_present))
 		return;
 #endif
 
-    exit(-1);
+	/* A kernel fault inside get_user() or put_user() means a bad user
+	   pointer: resume at the address they left in rax, returning -1. */
+	if (!user && thread_current ()->probing_user) {
+		f->rip = f->R.rax;
+		f->R.rax = -1;
+		return;
+	}
 
-    /* Count page faults. */
-    page_fault_cnt++;
+    exit(-1);
 
     /* If the fault is true fault, show info and exit. */
 	printf ("Page fault at %p: %s error %s page in %s context.\n",
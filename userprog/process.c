@@ -10,9 +10,11 @@
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
@@ -33,8 +35,6 @@ process_init (void) {
 	struct thread *current = thread_current ();
 }
 
-extern struct lock lock_for_filesys;
-
 /* Starts the first userland program, called "initd", loaded from FILE_NAME.
  * The new thread may be scheduled (and may even exit)
  * before process_create_initd() returns. Returns the initd's
@@ -194,9 +194,14 @@ __do_fork (void *aux) {
 	supplemental_page_table_init (&current->spt);
 	if (!supplemental_page_table_copy (&current->spt, &parent->spt))
 		goto error;
+	/* The child has every stack page the parent grew. */
+	current->stack_pointer = parent->stack_pointer;
 #else
 	if (!pml4_for_each (parent->pml4, duplicate_pte, parent))
 		goto error;
+#endif
+#ifdef FILESYS
+	current->cwd = inode_reopen (parent->cwd);
 #endif
     bool is_exist;
     struct file* copy_file;
@@ -269,9 +274,6 @@ process_exec (void *f_name) {
 
     palloc_free_page (file_name);
 
-    if (lock_held_by_current_thread(&lock_for_filesys))
-        lock_release(&lock_for_filesys);
-
     /* Start switched process. */
 	do_iret (&_if);
 	NOT_REACHED ();
@@ -325,14 +327,20 @@ process_exit (void) {
 	 * TODO: project2/process_termination.html).
 	 * TODO: We recommend you to implement process resource cleanup here. */
 
+    /* Leaves every entry of the file descriptor table null, so that
+     * it can be recycled for a new thread when this one is reaped. */
     for (int i = 0; i < FD_LIMIT; i++)
         close(i);
 
-    palloc_free_multiple(thread_current()->file_descriptor_table, N_FDT);
-
     /* Close currently executing file. */
     file_close(thread_current()->curr_exec_file);
 
+#ifdef FILESYS
+    /* Let go of the working directory. */
+    inode_close(thread_current()->cwd);
+    thread_current()->cwd = NULL;
+#endif
+
     /* Clean up. */
     process_cleanup();
 
@@ -349,9 +357,7 @@ process_cleanup (void) {
 	struct thread *curr = thread_current ();
 
 #ifdef VM
-    /* Returns true if H contains no elements, false otherwise. */
-    if(!hash_empty(&curr->spt.hash_table))
-        supplemental_page_table_kill (&curr->spt);
+	supplemental_page_table_kill (&curr->spt);
 #endif
 
 	uint64_t *pml4;
@@ -861,7 +867,7 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
 		size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-        faux = (struct file_aux*) malloc(sizeof(struct file_aux));
+        faux = kmem_cache_alloc(file_aux_cache);
 		faux->ofs = ofs;
 		faux->file = file;
 		faux->read_bytes = page_read_bytes;
@@ -1,5 +1,6 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
@@ -11,13 +12,14 @@
 #include "threads/flags.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/vaddr.h"
 #include "intrinsic.h"
+#include "devices/input.h"
 #include "vm/vm.h"
 
 void syscall_entry (void);
 void syscall_handler (struct intr_frame *);
 
-void is_valid_address (uint64_t* uaddr);
 struct page* get_page_from_address (uint64_t* addr);
 void is_valid_buffer(void* buffer, unsigned length, bool writable);
 struct file* get_file_with_fd (int fd);
@@ -38,10 +40,6 @@ int wait (tid_t tid);
 #define MSR_LSTAR 0xc0000082        /* Long mode SYSCALL target */
 #define MSR_SYSCALL_MASK 0xc0000084 /* Mask for the eflags */
 
-/* No internal synchronization. Concurrent accesses will interfere with one another.
- * You should use synchronization to ensure that only one process at a time is executing file system code. */
-struct lock lock_for_filesys;
-
 void
 syscall_init (void) {
 	write_msr(MSR_STAR, ((uint64_t)SEL_UCSEG - 0x10) << 48  |
@@ -53,14 +51,6 @@ syscall_init (void) {
 	 * mode stack. Therefore, we masked the FLAG_FL. */
 	write_msr(MSR_SYSCALL_MASK,
 			FLAG_IF | FLAG_TF | FLAG_DF | FLAG_IOPL | FLAG_AC | FLAG_NT);
-
-    /* Initialize lock for file system. */
-    lock_init(&lock_for_filesys);
-}
-
-void is_valid_address(uint64_t* uaddr) {
-    if (is_kernel_vaddr(uaddr))
-        exit(-1);
 }
 
 struct page*
@@ -74,18 +64,160 @@ get_page_from_address (uint64_t* uaddr) {
     return target_page;
 }
 
+/* Checks that [BUFFER, BUFFER + LENGTH) is mapped, and writable if
+ * WRITE is set.  Every byte of a page shares one SPT entry, so one
+ * lookup per page covers the whole range. */
 void
 is_valid_buffer(void* buffer, unsigned length, bool write) {
     struct page* target_page;
+    uint8_t* upage;
+    uint8_t* last;
 
-    for (int i=0; i<length; i++) {
-        target_page = get_page_from_address(buffer+i);
+    if (length == 0)
+        return;
+
+    last = (uint8_t*) buffer + length - 1;
+    if (last < (uint8_t*) buffer || is_kernel_vaddr(last))
+        exit(-1);
+
+    for (upage = pg_round_down(buffer); upage <= last; upage += PGSIZE) {
+        target_page = get_page_from_address((uint64_t*) upage);
 
         if (write == true && target_page->writable == false)
             exit(-1);
     }
 }
 
+/* Reads a byte at user virtual address UADDR.
+ * Returns the byte value if successful, -1 if a page fault occurred.
+ * On a fault page_fault() resumes at the label loaded into rax. */
+static int64_t
+get_user (const uint8_t* uaddr) {
+    int64_t result;
+
+    thread_current()->probing_user = true;
+    __asm __volatile (
+            "movabsq $1f, %0\n"
+            "movzbq %1, %0\n"
+            "1:\n"
+            : "=&a" (result) : "m" (*uaddr));
+    thread_current()->probing_user = false;
+
+    return result;
+}
+
+/* Writes BYTE to user address UDST.
+ * Returns true if successful, false if a page fault occurred. */
+static bool
+put_user (uint8_t* udst, uint8_t byte) {
+    int64_t error_code;
+
+    thread_current()->probing_user = true;
+    __asm __volatile (
+            "movabsq $1f, %0\n"
+            "movb %b2, %1\n"
+            "1:\n"
+            : "=&a" (error_code), "=m" (*udst) : "q" (byte));
+    thread_current()->probing_user = false;
+
+    return error_code != -1;
+}
+
+/* Copies SIZE bytes from user address USRC to kernel buffer DST.
+ * Each page is probed once, which faults it in or reports it invalid,
+ * and is then copied as a whole.  Returns false if any byte of the
+ * source is not readable by the user process. */
+bool
+copy_from_user (void* dst, const void* usrc, size_t size) {
+    uint8_t* d = dst;
+    const uint8_t* s = usrc;
+
+    if (size == 0)
+        return true;
+    if (s + size - 1 < s || is_kernel_vaddr(s + size - 1))
+        return false;
+
+    while (size > 0) {
+        size_t chunk = PGSIZE - pg_ofs(s);
+        if (chunk > size)
+            chunk = size;
+
+        if (get_user(s) == -1)
+            return false;
+        memcpy(d, s, chunk);
+
+        d += chunk;
+        s += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+/* Copies SIZE bytes from kernel buffer SRC to user address UDST.
+ * Returns false if any byte of the destination is not writable by
+ * the user process; bytes before the bad page have been written. */
+bool
+copy_to_user (void* udst, const void* src, size_t size) {
+    uint8_t* d = udst;
+    const uint8_t* s = src;
+
+    if (size == 0)
+        return true;
+    if (d + size - 1 < d || is_kernel_vaddr(d + size - 1))
+        return false;
+
+    while (size > 0) {
+        size_t chunk = PGSIZE - pg_ofs(d);
+        if (chunk > size)
+            chunk = size;
+
+        if (!put_user(d, *s))
+            return false;
+        memcpy(d, s, chunk);
+
+        d += chunk;
+        s += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+/* Copies the null-terminated string at user address USTR into a new
+ * page, probing each page of it once.  Returns the page, which the
+ * caller must free, or a null pointer if the string is not readable
+ * by the user process or does not fit in a page. */
+static char*
+copy_in_string (const char* ustr) {
+    char* kstr;
+    size_t len = 0;
+
+    kstr = palloc_get_page(0);
+    if (kstr == NULL)
+        return NULL;
+
+    while (len < PGSIZE) {
+        const char* s = ustr + len;
+        size_t chunk = PGSIZE - pg_ofs(s);
+        size_t n;
+
+        if (chunk > PGSIZE - len)
+            chunk = PGSIZE - len;
+        if (is_kernel_vaddr(s) || get_user((const uint8_t*) s) == -1)
+            break;
+
+        n = strnlen(s, chunk);
+        memcpy(kstr + len, s, n);
+        len += n;
+        if (n < chunk) {
+            kstr[len] = '\0';
+            return kstr;
+        }
+    }
+
+    palloc_free_page(kstr);
+    return NULL;
+}
+
 /* Halt the operating system. */
 void halt (void) {
     power_off();
@@ -106,25 +238,15 @@ void exit(int status) {
 
 /* Switch current process. */
 int exec (const char* file) {
-    is_valid_address((uint64_t*) file);
-
     /* Copy file name for parsing; It should not affect other jobs using file_name */
-    int n;
     char* fn_copy;
 
-    n = strlen(file) + 1;
-
-    fn_copy = palloc_get_page(PAL_ZERO);
+    fn_copy = copy_in_string(file);
     if (fn_copy == NULL)
         exit(-1);
 
-    strlcpy(fn_copy, file, n);
-
     int result;
 
-    if (!lock_held_by_current_thread(&lock_for_filesys))
-        lock_acquire(&lock_for_filesys);
-
     result = process_exec(fn_copy);
 
     if (result == -1)
@@ -142,35 +264,30 @@ int wait (tid_t tid) {
 
 /* Create a file. */
 bool create (const char* file, unsigned initial_size) {
+    char* name;
     bool result;
 
-    if (file == NULL)
+    name = copy_in_string(file);
+    if (name == NULL)
         exit(-1);
 
-
-    if (!lock_held_by_current_thread(&lock_for_filesys))
-        lock_acquire(&lock_for_filesys);
-
-    result = filesys_create(file, initial_size);
-
-    if (lock_held_by_current_thread(&lock_for_filesys))
-        lock_release(&lock_for_filesys);
+    result = filesys_create(name, initial_size);
+    palloc_free_page(name);
 
     return result;
 }
 
 /* Delete a file. */
 bool remove (const char* file) {
-    is_valid_address((uint64_t*) file);
+    char* name;
     bool result;
 
-    if (!lock_held_by_current_thread(&lock_for_filesys))
-        lock_acquire(&lock_for_filesys);
-
-    result = filesys_remove(file);
+    name = copy_in_string(file);
+    if (name == NULL)
+        exit(-1);
 
-    if (lock_held_by_current_thread(&lock_for_filesys))
-        lock_release(&lock_for_filesys);
+    result = filesys_remove(name);
+    palloc_free_page(name);
 
     return result;
 }
@@ -204,21 +321,20 @@ int put_fd_with_file (struct file* target_file) {
 
 /* Open a file. */
 int open (const char* file) {
-    is_valid_address((uint64_t*) file);
+    char* name;
     struct file* opened_file;
     int result;
 
-    /* For open-bad-ptr. */
+    /* For open-null. */
     if (file == NULL)
         return -1;
 
-    if (!lock_held_by_current_thread(&lock_for_filesys))
-        lock_acquire(&lock_for_filesys);
-
-    opened_file = filesys_open(file);
+    name = copy_in_string(file);
+    if (name == NULL)
+        exit(-1);
 
-    if (lock_held_by_current_thread(&lock_for_filesys))
-        lock_release(&lock_for_filesys);
+    opened_file = filesys_open(name);
+    palloc_free_page(name);
 
     if (opened_file == NULL)
         result = -1;
@@ -226,13 +342,7 @@ int open (const char* file) {
         result = put_fd_with_file(opened_file);
 
     if (result == -1 && opened_file != NULL) {
-        if (!lock_held_by_current_thread(&lock_for_filesys))
-            lock_acquire(&lock_for_filesys);
-
         file_close(opened_file);
-
-        if (lock_held_by_current_thread(&lock_for_filesys))
-            lock_release(&lock_for_filesys);
     }
 
     return result;
@@ -248,75 +358,96 @@ int filesize (int fd) {
     if (target_file == NULL)
         result = -1;
     else {
-        if (!lock_held_by_current_thread(&lock_for_filesys))
-            lock_acquire(&lock_for_filesys);
-
         result = (int) file_length(target_file);
-
-        if (lock_held_by_current_thread(&lock_for_filesys))
-            lock_release(&lock_for_filesys);
     }
     return result;
 }
 
-/* Read from a file. */
+/* Read from a file.
+ * Data passes through a kernel page, a page at a time, so that the
+ * file system and console only ever see kernel memory and a fault on
+ * BUFFER is taken with none of their locks held. */
 int read (int fd, void* buffer, unsigned length) {
-    int result;
-    struct file* target_file;
+    struct file* target_file = NULL;
+    uint8_t* bounce;
+    unsigned done = 0;
 
-    if (fd == 0) {
-        input_getc(buffer, length);
-        result = length;
-    }
-    else if (fd == 1)
-        result = -1;
-    else {
+    if (fd == 1)
+        return -1;
+    if (fd != 0) {
         target_file = get_file_with_fd(fd);
-
         if (target_file == NULL)
-            result = -1;
-        else {
-            if (!lock_held_by_current_thread(&lock_for_filesys))
-                lock_acquire(&lock_for_filesys);
+            return -1;
+    }
+
+    bounce = palloc_get_page(0);
+    if (bounce == NULL)
+        return -1;
 
-            result = (int) file_read(target_file, buffer, length);
+    while (done < length) {
+        size_t chunk = length - done < PGSIZE ? length - done : PGSIZE;
+        size_t n;
+
+        if (fd == 0) {
+            for (n = 0; n < chunk; n++)
+                bounce[n] = input_getc();
+        }
+        else
+            n = file_read(target_file, bounce, chunk);
 
-            if (lock_held_by_current_thread(&lock_for_filesys))
-                lock_release(&lock_for_filesys);
+        if (!copy_to_user((uint8_t*) buffer + done, bounce, n)) {
+            palloc_free_page(bounce);
+            exit(-1);
         }
+        done += n;
+        if (n < chunk)
+            break;
     }
 
-    return result;
+    palloc_free_page(bounce);
+    return done;
 }
 
-/* Write to a file. */
+/* Write to a file.
+ * Like read(), copies BUFFER in through a kernel page. */
 int write (int fd, const void* buffer, unsigned length) {
-    int result;
-    struct file* target_file;
+    struct file* target_file = NULL;
+    uint8_t* bounce;
+    unsigned done = 0;
 
     if (fd == 0)
-        result = -1;
-    else if (fd == 1) {
-        putbuf(buffer, length);
-        result = length;
-    }
-    else {
+        return -1;
+    if (fd != 1) {
         target_file = get_file_with_fd(fd);
-
         if (target_file == NULL)
-            result = -1;
-        else {
-            if (!lock_held_by_current_thread(&lock_for_filesys))
-                lock_acquire(&lock_for_filesys);
+            return -1;
+    }
 
-            result = (int) file_write(target_file, buffer, length);
+    bounce = palloc_get_page(0);
+    if (bounce == NULL)
+        return -1;
+
+    while (done < length) {
+        size_t chunk = length - done < PGSIZE ? length - done : PGSIZE;
+        size_t n = chunk;
 
-            if (lock_held_by_current_thread(&lock_for_filesys))
-                lock_release(&lock_for_filesys);
+        if (!copy_from_user(bounce, (const uint8_t*) buffer + done, chunk)) {
+            palloc_free_page(bounce);
+            exit(-1);
         }
+
+        if (fd == 1)
+            putbuf((const char*) bounce, chunk);
+        else
+            n = file_write(target_file, bounce, chunk);
+
+        done += n;
+        if (n < chunk)
+            break;
     }
 
-    return result;
+    palloc_free_page(bounce);
+    return done;
 }
 
 /* Change position in a file. */
@@ -328,13 +459,7 @@ void seek (int fd, unsigned position) {
     if (target_file == NULL || target_file <= 2)
         return;
     else {
-        if (!lock_held_by_current_thread(&lock_for_filesys))
-            lock_acquire(&lock_for_filesys);
-
         file_seek(target_file, position);
-
-        if (lock_held_by_current_thread(&lock_for_filesys))
-            lock_release(&lock_for_filesys);
     }
 }
 
@@ -348,14 +473,8 @@ unsigned tell (int fd) {
     if (target_file == NULL || target_file <=2)
         return;
     else {
-        if (!lock_held_by_current_thread(&lock_for_filesys))
-            lock_acquire(&lock_for_filesys);
-
         result = (unsigned) file_tell(target_file);
 
-        if (lock_held_by_current_thread(&lock_for_filesys))
-            lock_release(&lock_for_filesys);
-
     }
     return result;
 }
@@ -384,13 +503,7 @@ void close (int fd) {
         return;
     }
 
-    if (!lock_held_by_current_thread(&lock_for_filesys))
-        lock_acquire(&lock_for_filesys);
-
     file_close(target_file);
-
-    if (lock_held_by_current_thread(&lock_for_filesys))
-        lock_release(&lock_for_filesys);
 }
 
 bool is_valid_mmap(void* addr, size_t length, off_t ofs) {
@@ -453,9 +566,14 @@ syscall_handler (struct intr_frame *f UNUSED) {
             halt();
         case SYS_EXIT:
             exit(f->R.rdi);
-        case SYS_FORK:
-            f->R.rax = process_fork(f->R.rdi, f);
+        case SYS_FORK: {
+            char* name = copy_in_string((const char*) f->R.rdi);
+            if (name == NULL)
+                exit(-1);
+            f->R.rax = process_fork(name, f);
+            palloc_free_page(name);
             break;
+        }
         case SYS_EXEC:
             f->R.rax = exec(f->R.rdi);
             if (f->R.rax == -1)
@@ -1,11 +1,10 @@
 /* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page). */
 
 #include "vm/vm.h"
-#include "devices/disk.h"
-#include "lib/kernel/bitmap.h"
+#include "vm/swap.h"
+#include "threads/mmu.h"
 
 /* DO NOT MODIFY BELOW LINE */
-static struct disk* swap_disk;
 static bool anon_swap_in (struct page *page, void *kva);
 static bool anon_swap_out (struct page *page);
 static void anon_destroy (struct page *page);
@@ -18,18 +17,10 @@ static const struct page_operations anon_ops = {
 	.type = VM_ANON,
 };
 
-struct bitmap* swap_bitmap;
-
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
-    size_t swap_n_bits;
-
-    /* 1:1 - swap */
-	swap_disk = disk_get(1, 1);
-
-    swap_n_bits = disk_size(swap_disk) / (PGSIZE / DISK_SECTOR_SIZE);
-    swap_bitmap = bitmap_create(swap_n_bits);
+    swap_init();
 }
 
 /* Initialize the file mapping */
@@ -39,55 +30,79 @@ anon_initializer (struct page *page, enum vm_type type, void *kva) {
 	page->operations = &anon_ops;
 
 	struct anon_page *anon_page = &page->anon;
+    anon_page->swap_slot = SWAP_SLOT_NONE;
+    return true;
 }
 
 /* Swap in the page by read contents from the swap disk. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
-    int bit;
-    bool result;
 	struct anon_page* anon_page = &page->anon;
 
-    bit = anon_page->swap_bit;
-    result = bitmap_test(swap_bitmap, bit);
+    if (anon_page->swap_slot == SWAP_SLOT_NONE)
+        return false;
 
-    if (result) {
-        for (int index = 0; index < PGSIZE / DISK_SECTOR_SIZE; ++index)
-            disk_read(swap_disk, bit * (PGSIZE / DISK_SECTOR_SIZE) + index, kva + DISK_SECTOR_SIZE * index);
+    swap_read(anon_page->swap_slot, kva);
+    swap_slot_free(anon_page->swap_slot, 1);
+    anon_page->swap_slot = SWAP_SLOT_NONE;
 
-        bitmap_set(swap_bitmap, bit, false);
-    }
-
-    return result;
+    return true;
 }
 
 /* Swap out the page by writing contents to the swap disk. */
 static bool
 anon_swap_out (struct page *page) {
-    int bit;
-    bool result = true;
-	struct anon_page* anon_page = &page->anon;
-
-    bit = bitmap_scan(swap_bitmap, 0, 1, false);
-    if (bit == BITMAP_ERROR)
-        result = false;
-
-    if (result) {
-        for (int index = 0; index < PGSIZE / DISK_SECTOR_SIZE; ++index)
-            disk_write(swap_disk, bit * PGSIZE / DISK_SECTOR_SIZE + index, page->va + DISK_SECTOR_SIZE * index);
-
-        bitmap_set(swap_bitmap, bit, true);
-        pml4_clear_page(thread_current()->pml4, page->va);
+    return anon_swap_out_cluster(&page->frame, 1) == 1;
+}
 
-        anon_page->swap_bit = bit;
+/* Swaps out the first CNT frames of FRAMES, at most SWAP_CLUSTER, in
+ * one write to consecutive swap slots.  If no run of CNT slots is
+ * free, only FRAMES[0] goes out.  Every page sharing a frame after
+ * fork() is unmapped and takes a reference to the frame's slot.
+ * Returns the number of frames swapped out, which are always the
+ * first ones. */
+size_t
+anon_swap_out_cluster (struct frame *frames[], size_t cnt) {
+    void* kvas[SWAP_CLUSTER];
+    size_t slot;
+
+    ASSERT (cnt > 0 && cnt <= SWAP_CLUSTER);
+
+    slot = swap_slot_alloc(cnt);
+    if (slot == SWAP_SLOT_NONE && cnt > 1) {
+        cnt = 1;
+        slot = swap_slot_alloc(cnt);
+    }
+    if (slot == SWAP_SLOT_NONE)
+        return 0;
+
+    for (size_t i = 0; i < cnt; i++) {
+        struct list_elem* e;
+
+        /* The pages may belong to any process: unmap each in its own
+         * page map before writing, so no owner can change it
+         * mid-write, and read the contents through the frame. */
+        for (e = list_begin(&frames[i]->sharers); e != list_end(&frames[i]->sharers);
+                e = list_next(e)) {
+            struct page* page = list_entry(e, struct page, elem_for_frame);
+
+            pml4_clear_page(page->pml4, page->va);
+            page->anon.swap_slot = slot + i;
+            if (e != list_begin(&frames[i]->sharers))
+                swap_slot_dup(slot + i);
+        }
+        kvas[i] = frames[i]->kva;
     }
+    swap_write(slot, kvas, cnt);
 
-    return result;
+    return cnt;
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
 	struct anon_page* anon_page = &page->anon;
-    return;
+
+    if (anon_page->swap_slot != SWAP_SLOT_NONE)
+        swap_slot_free(anon_page->swap_slot, 1);
 }
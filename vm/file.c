@@ -1,6 +1,7 @@
 /* file.c: Implementation of memory backed file object (mmaped object). */
 
 #include "vm/vm.h"
+#include "threads/malloc.h"
 #include "userprog/process.h"
 
 static bool file_backed_swap_in (struct page *page, void *kva);
@@ -15,9 +16,14 @@ static const struct page_operations file_ops = {
 	.type = VM_FILE,
 };
 
+/* Cache for the file_aux of lazily loaded pages. */
+struct kmem_cache *file_aux_cache;
+
 /* The initializer of file vm */
 void
 vm_file_init (void) {
+	file_aux_cache = kmem_cache_create ("file_aux", sizeof (struct file_aux),
+			NULL);
 }
 
 /* Initialize the file backed page */
@@ -62,21 +68,22 @@ file_backed_swap_in (struct page *page, void *kva) {
 /* Swap out the page by writeback contents to the file. */
 static bool
 file_backed_swap_out (struct page *page) {
-    struct thread* curr;
     struct file_aux* faux;
 
     if (&page->file == NULL)
         return false;
 
-    curr = thread_current();
     faux = (struct file_aux*) page->uninit.aux;
 
-    if (pml4_is_dirty(curr->pml4, page->va)) {
-        file_write_at(faux->file, page->va, faux->read_bytes, faux->ofs);
-        pml4_set_dirty (curr->pml4, page->va, 0);
+    /* PAGE may belong to any process.  Unmap it first so the owner
+     * cannot dirty it during the write-back; the dirty bit survives. */
+    pml4_clear_page(page->pml4, page->va);
+
+    if (pml4_is_dirty(page->pml4, page->va)) {
+        file_write_at(faux->file, page->frame->kva, faux->read_bytes, faux->ofs);
+        pml4_set_dirty (page->pml4, page->va, 0);
     }
 
-    pml4_clear_page(curr->pml4, page->va);
     return true;
 }
 
@@ -106,7 +113,7 @@ do_mmap (void *addr, size_t length, int writable,
         size_t page_read_bytes = should_read_bytes < PGSIZE ? should_read_bytes : PGSIZE;
         size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-        faux = (struct file_aux*) malloc(sizeof(struct file_aux));
+        faux = kmem_cache_alloc(file_aux_cache);
         faux->ofs = offset;
         faux->file = target_file;
         faux->read_bytes = page_read_bytes;
@@ -138,7 +145,15 @@ do_munmap (void *addr) {
         faux = (struct file_aux*) target_page->uninit.aux;
 
         if (pml4_is_dirty(curr->pml4, target_page->va)) {
-            file_write_at(faux->file, addr, faux->read_bytes, faux->ofs);
+            /* Write from the frame, not through ADDR: the file system
+             * never touches user memory, which could fault while it
+             * holds the file's locks.  The pin keeps the frame from
+             * being evicted during the write. */
+            struct frame* frame = page_pin_resident(target_page);
+            if (frame != NULL) {
+                file_write_at(faux->file, frame->kva, faux->read_bytes, faux->ofs);
+                frame->pinned = false;
+            }
             pml4_set_dirty(curr->pml4, target_page->va, 0);
         }
 
@@ -0,0 +1,118 @@
+/* swap.c: Swap slot allocation and swap disk I/O. */
+
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include "devices/disk.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+#define SECTORS_PER_SLOT (PGSIZE / DISK_SECTOR_SIZE)
+
+static struct disk *swap_disk;
+
+/* Slot usage, one bit per slot.  Allocation is next-fit: the search
+ * starts where the last allocation ended, so a run of evictions takes
+ * consecutive slots and never rescans the used slots at the front. */
+static struct bitmap *swap_bitmap;
+static size_t swap_cursor;
+
+/* References to each slot.  After fork() a swapped-out page is shared
+ * by parent and child, one reference each, and its slot is free once
+ * every sharer has read it back or gone away. */
+static uint16_t *swap_refs;
+static struct lock swap_lock;           /* Protects the above. */
+
+/* Statistics. */
+static long long swap_read_cnt;         /* Pages read back. */
+static long long swap_write_cnt;        /* Pages written. */
+static long long swap_request_cnt;      /* Write requests, one per cluster. */
+
+/* Finds the swap disk and marks every slot free. */
+void
+swap_init (void) {
+	/* 1:1 - swap */
+	swap_disk = disk_get (1, 1);
+	if (swap_disk == NULL)
+		PANIC ("no swap disk");
+
+	swap_bitmap = bitmap_create (disk_size (swap_disk) / SECTORS_PER_SLOT);
+	if (swap_bitmap == NULL)
+		PANIC ("cannot allocate swap bitmap");
+	swap_refs = calloc (bitmap_size (swap_bitmap), sizeof *swap_refs);
+	if (swap_refs == NULL)
+		PANIC ("cannot allocate swap reference counts");
+	lock_init (&swap_lock);
+}
+
+/* Allocates CNT consecutive slots, with one reference each, and
+ * returns the first one, or SWAP_SLOT_NONE if no such run is free. */
+size_t
+swap_slot_alloc (size_t cnt) {
+	size_t slot;
+
+	lock_acquire (&swap_lock);
+	slot = bitmap_scan_and_flip (swap_bitmap, swap_cursor, cnt, false);
+	if (slot == BITMAP_ERROR && swap_cursor != 0)
+		slot = bitmap_scan_and_flip (swap_bitmap, 0, cnt, false);
+	if (slot != BITMAP_ERROR) {
+		swap_cursor = slot + cnt < bitmap_size (swap_bitmap) ? slot + cnt : 0;
+		for (size_t i = 0; i < cnt; i++)
+			swap_refs[slot + i] = 1;
+	}
+	lock_release (&swap_lock);
+
+	return slot != BITMAP_ERROR ? slot : SWAP_SLOT_NONE;
+}
+
+/* Adds a reference to SLOT, which is in use, for one more page that
+ * shares its contents. */
+void
+swap_slot_dup (size_t slot) {
+	lock_acquire (&swap_lock);
+	ASSERT (bitmap_test (swap_bitmap, slot));
+	ASSERT (swap_refs[slot] < UINT16_MAX);
+	swap_refs[slot]++;
+	lock_release (&swap_lock);
+}
+
+/* Drops a reference to each of the CNT slots starting at SLOT, and
+ * frees the slots that have none left. */
+void
+swap_slot_free (size_t slot, size_t cnt) {
+	lock_acquire (&swap_lock);
+	ASSERT (bitmap_all (swap_bitmap, slot, cnt));
+	for (size_t i = slot; i < slot + cnt; i++)
+		if (--swap_refs[i] == 0)
+			bitmap_reset (swap_bitmap, i);
+	lock_release (&swap_lock);
+}
+
+/* Reads the page in SLOT into KVA. */
+void
+swap_read (size_t slot, void *kva) {
+	disk_read_multiple (swap_disk, slot * SECTORS_PER_SLOT, SECTORS_PER_SLOT,
+			kva);
+	swap_read_cnt++;
+}
+
+/* Writes the CNT pages at KVAS to the consecutive slots starting at
+ * SLOT, as one gather write of CNT * SECTORS_PER_SLOT sectors. */
+void
+swap_write (size_t slot, void *kvas[], size_t cnt) {
+	ASSERT (cnt <= SWAP_CLUSTER);
+
+	disk_write_gather (swap_disk, slot * SECTORS_PER_SLOT, kvas, cnt,
+			SECTORS_PER_SLOT);
+	swap_write_cnt += cnt;
+	swap_request_cnt++;
+}
+
+/* Prints swap statistics. */
+void
+swap_print_stats (void) {
+	printf ("Swap: %lld pages read, %lld pages written in %lld requests\n",
+			swap_read_cnt, swap_write_cnt, swap_request_cnt);
+}
@@ -1,15 +1,67 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
+#include <stdio.h>
+#include <string.h>
+#include <intrinsic.h>
 #include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
 #include "vm/vm.h"
 #include "vm/inspect.h"
+#include "vm/swap.h"
 #include "userprog/process.h"
 
-/* Helper functions. */
-static uint64_t get_value_from_hash_table (struct hash_elem* target_elem, void* aux UNUSED);
-static bool compare_hash_value (struct hash_elem* first_elem, struct hash_elem* second_elem, void* aux UNUSED);
+/* Supplemental page table radix tree.  Level 0 is indexed like the
+ * pml4, level SPT_LEVELS - 1 like a page table and holds the pages. */
+#define SPT_LEVELS 4
+#define SPT_FANOUT (PGSIZE / sizeof (void *))
+static const uint64_t spt_shifts[SPT_LEVELS] = {
+    PML4SHIFT, PDPESHIFT, PDXSHIFT, PTXSHIFT
+};
 
+/* Helper functions. */
+static struct page** spt_walk (struct supplemental_page_table* spt, void* va, bool create);
+static bool spt_node_for_each (void** node, int level, uint64_t base,
+        uint64_t start, uint64_t end, spt_for_each_func* func, void* aux);
+static void spt_node_destroy (void** node, int level);
+static void frame_attach (struct frame* frame, struct page* page);
+static void frame_detach (struct page* page);
+static struct frame* frame_alloc (void);
+static void frame_free (struct frame* frame);
+static void frame_wait_evicted (struct page* page);
+static void kswapd (void* aux);
+
+/* Caches for pages and frames, the most frequently allocated VM
+ * objects. */
+static struct kmem_cache* page_cache;
+static struct kmem_cache* frame_cache;
+
+/* Frame table: every frame of the user pool that backs a page of any
+ * process.  FRAME_LOCK protects the list, the clock hand, and the
+ * sharers, owner and pin state of every frame in it. */
 struct list frame_list;
+static struct lock frame_lock;
+static struct condition evict_done;     /* Signaled when a write-out ends. */
+static struct list_elem* clock_hand;    /* Next frame the clock looks at. */
+static size_t frame_cnt;                /* Frames in frame_list. */
+
+/* Background page-out.  Once free frames in the user pool drop
+ * below vm_low_watermark, kswapd evicts until there are
+ * vm_high_watermark free, so that most faults find a free frame. */
+size_t vm_low_watermark = 16;
+size_t vm_high_watermark = 32;
+static struct semaphore kswapd_sema;    /* Upped to wake kswapd. */
+static bool kswapd_awake;               /* Woken and not yet done. */
+
+/* Statistics. */
+static long long evict_cnt;             /* Frames taken by eviction. */
+static long long kswapd_evict_cnt;      /* Of those, freed by kswapd. */
+
+/* Page fault latency histogram.  Bucket I counts the faults that
+ * took fewer than 2^(I + 1) cycles. */
+#define FAULT_BUCKETS 64
+static long long fault_hist[FAULT_BUCKETS];
+static long long fault_cnt;
 
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
@@ -24,8 +76,51 @@ vm_init (void) {
 	/* DO NOT MODIFY UPPER LINES. */
 	/* TODO: Your code goes here. */
 
+    page_cache = kmem_cache_create("page", sizeof(struct page), NULL);
+    frame_cache = kmem_cache_create("frame", sizeof(struct frame), NULL);
+
     /* Initialize list of frames. */
     list_init(&frame_list);
+    lock_init(&frame_lock);
+    cond_init(&evict_done);
+    clock_hand = list_end(&frame_list);
+
+    /* The user pool is still empty here.  Keep the watermarks well
+     * below its size, or kswapd would evict every frame. */
+    size_t user_pages = palloc_free_cnt(PAL_USER);
+    if (vm_high_watermark > user_pages / 4)
+        vm_high_watermark = user_pages / 4;
+    if (vm_low_watermark > vm_high_watermark)
+        vm_low_watermark = vm_high_watermark;
+
+    sema_init(&kswapd_sema, 0);
+    if (vm_high_watermark > 0)
+        thread_create("kswapd", PRI_DEFAULT, kswapd, NULL);
+}
+
+/* Returns the upper bound, in cycles, of the histogram bucket that
+ * holds the fault at permille P of all faults by latency. */
+static uint64_t
+fault_percentile (int p) {
+    long long rank = (fault_cnt * p + 999) / 1000;
+    long long seen = 0;
+
+    for (int i = 0; i < FAULT_BUCKETS; i++) {
+        seen += fault_hist[i];
+        if (seen >= rank && seen > 0)
+            return 1ULL << (i + 1);
+    }
+    return 0;
+}
+
+/* Prints virtual memory statistics. */
+void
+vm_print_stats (void) {
+    printf("VM: %zu frames in use, %lld evictions (%lld by kswapd)\n",
+            frame_cnt, evict_cnt, kswapd_evict_cnt);
+    printf("VM: %lld faults, latency p50 < %llu, p99 < %llu, p99.9 < %llu cycles\n",
+            fault_cnt, fault_percentile(500), fault_percentile(990),
+            fault_percentile(999));
 }
 
 /* Get the type of RRthe page. This function is useful if you want to know the
@@ -46,7 +141,6 @@ page_get_type (struct page *page) {
 static struct frame* vm_get_victim (void);
 static bool vm_do_claim_page (struct page *page);
 static struct frame* vm_evict_frame (void);
-static void hash_destroy_func (struct hash_elem* e, void* aux UNUSED);
 
 /* Create the pending page object with initializer. If you want to create a
  * page, do not create it directly and make it through this function or
@@ -63,7 +157,7 @@ vm_alloc_page_with_initializer (enum vm_type type, void* upage, bool writable,
 	/* Check wheter the upage is already occupied or not. */
 	if (spt_find_page(spt, upage) == NULL) {
 
-        new_page = (struct page*) malloc(sizeof(struct page));
+        new_page = kmem_cache_alloc(page_cache);
 
         switch (VM_TYPE(type)) {
             case VM_ANON:
@@ -78,118 +172,427 @@ vm_alloc_page_with_initializer (enum vm_type type, void* upage, bool writable,
         }
 
         new_page->writable = writable;
+        new_page->pml4 = thread_current()->pml4;
         return spt_insert_page(spt, new_page);
 	}
 err:
     return false;
 }
 
+/* Returns the leaf slot for VA in SPT.  If the path to the slot does
+ * not exist, allocates the missing nodes when CREATE is true and
+ * returns NULL otherwise (or if allocation fails). */
+static struct page**
+spt_walk (struct supplemental_page_table* spt, void* va, bool create) {
+    void*** slot = &spt->root;
+
+    for (int level = 0; level < SPT_LEVELS; level++) {
+        if (*slot == NULL) {
+            if (!create)
+                return NULL;
+
+            *slot = palloc_get_page(PAL_ZERO);
+            if (*slot == NULL)
+                return NULL;
+        }
+        slot = (void***) &(*slot)[((uint64_t) va >> spt_shifts[level]) & (SPT_FANOUT - 1)];
+    }
+
+    return (struct page**) slot;
+}
+
 /* Find VA from spt and return page. On error, return NULL. */
 struct page*
 spt_find_page (struct supplemental_page_table* spt, void* va) {
-    struct page* dummy_page;
-    struct page* target_page;
-    struct hash_elem* target_hash_elem;
+    struct page** slot = spt_walk(spt, va, false);
 
-    /* Allocate memory for dummy page (Just for finding target hash element. */
-    dummy_page = (struct page*) malloc(sizeof(struct page));
+    return slot != NULL ? *slot : NULL;
+}
 
-    /* Start point of the va which is offset 0*/
-    dummy_page->va = pg_round_down(va);
+/* Insert PAGE into spt with validation. */
+bool
+spt_insert_page (struct supplemental_page_table *spt, struct page *page) {
+    struct page** slot = spt_walk(spt, page->va, true);
 
-    /* Find the target hash element of target va. */
-    target_hash_elem = hash_find(spt->hash_table, &(dummy_page->elem_for_hash_table));
+    /* Fails if out of memory or the corresponding page already exists. */
+    if (slot == NULL || *slot != NULL)
+        return false;
 
-    /* Remove dummy page. */
-    free(dummy_page);
+    *slot = page;
+	return true;
+}
 
-    if (target_hash_elem == NULL)
-        return NULL;
+void
+spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
+    struct page** slot = spt_walk(spt, page->va, false);
 
-    /* Get target page using target hash element. */
-    target_page = hash_entry(target_hash_elem, struct page, elem_for_hash_table);
-    return target_page;
+    if (slot != NULL && *slot == page)
+        *slot = NULL;
+
+    lock_acquire(&frame_lock);
+    frame_wait_evicted(page);
+    if (page->frame != NULL) {
+        pml4_clear_page(page->pml4, page->va);
+        frame_detach(page);
+    }
+    lock_release(&frame_lock);
+	vm_dealloc_page (page);
 }
 
-/* Insert PAGE into spt with validation. */
+/* Calls FUNC on every page in SPT whose address is in [START, END),
+ * in ascending address order.  FUNC may remove the page it is given.
+ * Returns false if FUNC stopped the iteration, true otherwise. */
 bool
-spt_insert_page (struct supplemental_page_table *spt, struct page *page) {
-	int succ = true;
-    struct hash_elem* return_hash_elem;
+spt_for_each (struct supplemental_page_table* spt, void* start, void* end,
+        spt_for_each_func* func, void* aux) {
+    if (spt->root == NULL || start >= end)
+        return true;
 
-    /* Inserts new page to hash table using hash_elem.
-     * Returns hash_elem if the corresponding page already exists, otherwise NULL. */
-    return_hash_elem = hash_insert (spt->hash_table, &(page->elem_for_hash_table));
+    return spt_node_for_each(spt->root, 0, 0, (uint64_t) start, (uint64_t) end, func, aux);
+}
 
-    /* If return value is NULL, successfully inserted. */
-    if (return_hash_elem != NULL)
-        succ = false;
+static bool
+spt_node_for_each (void** node, int level, uint64_t base,
+        uint64_t start, uint64_t end, spt_for_each_func* func, void* aux) {
+    uint64_t shift = spt_shifts[level];
+    size_t i = start > base ? (start >> shift) & (SPT_FANOUT - 1) : 0;
+
+    for (; i < SPT_FANOUT; i++) {
+        uint64_t va = base | ((uint64_t) i << shift);
+        void* child = node[i];
+
+        if (va >= end)
+            break;
+        if (child == NULL)
+            continue;
+
+        if (level == SPT_LEVELS - 1) {
+            if (!func((struct page*) child, aux))
+                return false;
+        }
+        else if (!spt_node_for_each(child, level + 1, va, start, end, func, aux))
+            return false;
+    }
 
-	return succ;
+    return true;
 }
 
-void
-spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
-	vm_dealloc_page (page);
-	return true;
+/* Frees NODE at LEVEL and every node below it, but not the pages. */
+static void
+spt_node_destroy (void** node, int level) {
+    if (level < SPT_LEVELS - 1) {
+        for (size_t i = 0; i < SPT_FANOUT; i++)
+            if (node[i] != NULL)
+                spt_node_destroy(node[i], level + 1);
+    }
+    palloc_free_page(node);
+}
+
+/* Links PAGE to FRAME as one more sharer.  FRAME_LOCK must be held. */
+static void
+frame_attach (struct frame* frame, struct page* page) {
+    ASSERT (lock_held_by_current_thread(&frame_lock));
+
+    page->frame = frame;
+    list_push_back(&frame->sharers, &page->elem_for_frame);
+    if (frame->ref_cnt++ == 0) {
+        frame->page = page;
+        frame->pml4 = page->pml4;
+    }
 }
 
-/* Get the struct frame, that will be evicted. */
+/* Unlinks PAGE from its frame, which is freed once no page maps it.
+ * The caller must hold FRAME_LOCK and have removed PAGE's mapping. */
+static void
+frame_detach (struct page* page) {
+    struct frame* frame = page->frame;
+
+    ASSERT (lock_held_by_current_thread(&frame_lock));
+
+    if (frame == NULL)
+        return;
+
+    list_remove(&page->elem_for_frame);
+    page->frame = NULL;
+
+    if (--frame->ref_cnt == 0)
+        frame_free(frame);
+    else if (frame->page == page) {
+        frame->page = list_entry(list_front(&frame->sharers), struct page, elem_for_frame);
+        frame->pml4 = frame->page->pml4;
+    }
+}
+
+/* Removes FRAME, which no page maps, from the frame table and
+ * returns it to the user pool.  FRAME_LOCK must be held. */
+static void
+frame_free (struct frame* frame) {
+    ASSERT (lock_held_by_current_thread(&frame_lock));
+    ASSERT (frame->ref_cnt == 0);
+
+    if (clock_hand == &frame->elem_for_frame_list)
+        clock_hand = list_next(clock_hand);
+    list_remove(&frame->elem_for_frame_list);
+    frame_cnt--;
+
+    palloc_free_page(frame->kva);
+    kmem_cache_free(frame_cache, frame);
+}
+
+/* Waits until the frame of PAGE, if any, is no longer being written
+ * out.  Afterwards PAGE either is resident in a frame that cannot be
+ * evicted before FRAME_LOCK is released, or has no frame.  FRAME_LOCK
+ * must be held; it is released while waiting. */
+static void
+frame_wait_evicted (struct page* page) {
+    ASSERT (lock_held_by_current_thread(&frame_lock));
+
+    while (page->frame != NULL && page->frame->evicting)
+        cond_wait(&evict_done, &frame_lock);
+}
+
+/* Returns true if any page mapping FRAME was accessed since the last
+ * call, and clears the accessed bits. */
+static bool
+frame_test_accessed (struct frame* frame) {
+    bool accessed = false;
+
+    for (struct list_elem* e = list_begin(&frame->sharers);
+            e != list_end(&frame->sharers); e = list_next(e)) {
+        struct page* page = list_entry(e, struct page, elem_for_frame);
+
+        if (pml4_is_accessed(page->pml4, page->va)) {
+            pml4_set_accessed(page->pml4, page->va, false);
+            accessed = true;
+        }
+    }
+
+    return accessed;
+}
+
+/* Advances the clock hand over at most BUDGET frames and returns the
+ * first one that can be evicted, or NULL if none is found.
+ * Second-chance clock over the frames of every process.  The hand
+ * keeps its place between calls; a frame that any sharer accessed
+ * since the hand last passed has the bits cleared and is skipped
+ * once.  Pinned frames are never chosen. */
+static struct frame *
+clock_scan (size_t budget) {
+	struct frame* candidate;
+
+    ASSERT (lock_held_by_current_thread(&frame_lock));
+
+    while (budget-- > 0) {
+        if (clock_hand == list_end(&frame_list))
+            clock_hand = list_begin(&frame_list);
+
+        candidate = list_entry(clock_hand, struct frame, elem_for_frame_list);
+        clock_hand = list_next(clock_hand);
+
+        if (candidate->pinned || candidate->ref_cnt == 0)
+            continue;
+
+        if (!frame_test_accessed(candidate))
+            return candidate;
+    }
+
+	return NULL;
+}
+
+/* Get the struct frame, that will be evicted.
+ * Returns NULL if two full sweeps of the clock find no candidate. */
 static struct frame *
 vm_get_victim (void) {
-	struct frame* victim;
-    struct list_elem* current_list_elem;
+	return clock_scan(2 * frame_cnt);
+}
 
-     if (!list_empty(&frame_list)) {
-         current_list_elem = list_begin(&frame_list);
+/* Marks VICTIM, which must be pinned, as being written out.  FRAME_LOCK
+ * may then be released for the write: its page is unmapped, and a
+ * thread that looks up the page waits in frame_wait_evicted(). */
+static void
+frame_start_eviction (struct frame* victim) {
+    ASSERT (victim->pinned);
 
-         while (current_list_elem != list_end(&frame_list)) {
-             victim = list_entry(current_list_elem, struct frame, elem_for_frame_list);
-             if (pml4_is_accessed(thread_current()->pml4, victim->page->va))
-                 pml4_set_accessed (thread_current()->pml4, victim->page->va, 0);
-             else
-                 break;
+    victim->evicting = true;
+}
 
-             current_list_elem = list_next(current_list_elem);
-         }
-     }
+/* Ends the write-out of VICTIM and wakes the threads waiting for it.
+ * FRAME_LOCK must be held again. */
+static void
+frame_end_eviction (struct frame* victim) {
+    victim->evicting = false;
+    victim->pinned = false;
+    cond_broadcast(&evict_done, &frame_lock);
+}
 
-	return victim;
+/* Unlinks the pages swapped out of VICTIM, which is kept for reuse. */
+static void
+frame_evicted (struct frame* victim) {
+    while (!list_empty(&victim->sharers)) {
+        struct page* page = list_entry(list_pop_front(&victim->sharers),
+                struct page, elem_for_frame);
+        page->frame = NULL;
+    }
+    victim->ref_cnt = 0;
+
+    evict_cnt++;
+}
+
+/* Evicts VICTIM, whose pages are anonymous, together with up to
+ * SWAP_CLUSTER - 1 more anonymous frames the clock picks next, in one
+ * swap write.  A frame shared after fork() is evicted from all of its
+ * sharers, which then share its swap slot.  The extra frames go back to the user pool, so the next
+ * faults find a free frame without evicting.  Returns VICTIM, or NULL
+ * if swap is full. */
+static struct frame *
+vm_evict_anon_cluster (struct frame* victim) {
+    struct frame* frames[SWAP_CLUSTER];
+    size_t cnt = 0;
+    size_t done;
+
+    /* Pin the victims so the scan does not pick one twice.  Stop at
+     * the first page that is not anonymous; the hand has cleared its
+     * accessed bit, so it is picked first next time. */
+    do {
+        victim->pinned = true;
+        frame_start_eviction(victim);
+        frames[cnt++] = victim;
+    } while (cnt < SWAP_CLUSTER
+            && (victim = clock_scan(SWAP_CLUSTER)) != NULL
+            && victim->page->operations->type == VM_ANON);
+
+    lock_release(&frame_lock);
+    done = anon_swap_out_cluster(frames, cnt);
+    lock_acquire(&frame_lock);
+
+    for (size_t i = 0; i < cnt; i++)
+        frame_end_eviction(frames[i]);
+    if (done == 0)
+        return NULL;
+
+    for (size_t i = 0; i < done; i++)
+        frame_evicted(frames[i]);
+    for (size_t i = 1; i < done; i++)
+        frame_free(frames[i]);
+
+    return frames[0];
 }
 
 /* Evict one page and return the corresponding frame.
- * Return NULL on error.*/
+ * Return NULL on error.  FRAME_LOCK must be held; it is released
+ * during the write, so other faults and kswapd are not held up by
+ * the disk. */
 static struct frame *
 vm_evict_frame (void) {
 	struct frame *victim = vm_get_victim ();
+    bool result;
+
+    if (victim == NULL)
+        return NULL;
 
-    /* Swap out the page. */
-    swap_out(victim->page);
+    if (victim->page->operations->type == VM_ANON)
+        return vm_evict_anon_cluster(victim);
+
+    victim->pinned = true;
+    frame_start_eviction(victim);
+    lock_release(&frame_lock);
+    result = swap_out(victim->page);
+    lock_acquire(&frame_lock);
+    frame_end_eviction(victim);
+
+    if (!result)
+        return NULL;
+
+    frame_evicted(victim);
 	return victim;
 }
 
-/* palloc() and get frame. If there is no available page, evict the page
- * and return it. This always return valid address. That is, if the user pool
- * memory is full, this function evicts the frame to get the available memory
- * space.*/
+/* Takes a free frame from the user pool, or evicts one, and returns
+ * it pinned and not linked to any page.  FRAME_LOCK must be held; it
+ * is released while an evicted page is written out. */
 static struct frame *
-vm_get_frame (void) {
-	struct frame* new_frame = NULL;
+frame_alloc (void) {
+	struct frame* new_frame;
+    void* kva;
 
-    /* Allocate memory for new frame. */
-    new_frame = (struct frame*) malloc(sizeof(struct frame));
+    ASSERT (lock_held_by_current_thread(&frame_lock));
 
     /* Get new page from user pool. */
-    new_frame->kva = palloc_get_page(PAL_USER);
+    kva = palloc_get_page(PAL_USER);
+
+    if (!kswapd_awake && palloc_free_cnt(PAL_USER) < vm_low_watermark) {
+        kswapd_awake = true;
+        sema_up(&kswapd_sema);
+    }
 
     /* If user pool is full, it returns null pointer. Should evict and fetch. */
-    if (new_frame->kva == NULL)
+    if (kva == NULL) {
         new_frame = vm_evict_frame();
-    else
-        list_push_back(&frame_list, &(new_frame->elem_for_frame_list));
+        if (new_frame == NULL)
+            PANIC ("out of frames and swap space");
+    }
+    else {
+        /* Allocate memory for new frame. */
+        new_frame = kmem_cache_alloc(frame_cache);
+        if (new_frame == NULL)
+            PANIC ("out of memory for the frame table");
+
+        new_frame->kva = kva;
+        list_init(&new_frame->sharers);
+        new_frame->ref_cnt = 0;
+        new_frame->evicting = false;
+
+        /* Behind the hand, so it gets a full sweep before it is looked at. */
+        list_insert(clock_hand, &new_frame->elem_for_frame_list);
+        frame_cnt++;
+    }
 
     /* Make page NULL so that it could connect to new virtual page. */
     new_frame->page = NULL;
+    new_frame->pml4 = NULL;
+    new_frame->pinned = true;
+
+    return new_frame;
+}
+
+/* Page-out daemon.  Sleeps until frame_alloc() finds the user pool
+ * below the low watermark, then evicts a cluster at a time and frees
+ * the frames until the pool is at the high watermark or nothing more
+ * can be evicted.  FRAME_LOCK is dropped during each write. */
+static void
+kswapd (void* aux UNUSED) {
+    struct frame* victim;
+
+    for (;;) {
+        sema_down(&kswapd_sema);
+
+        lock_acquire(&frame_lock);
+        while (palloc_free_cnt(PAL_USER) < vm_high_watermark
+                && (victim = vm_evict_frame()) != NULL) {
+            frame_free(victim);
+            kswapd_evict_cnt++;
+
+            /* Let the faulting threads in between clusters. */
+            lock_release(&frame_lock);
+            thread_yield();
+            lock_acquire(&frame_lock);
+        }
+        kswapd_awake = false;
+        lock_release(&frame_lock);
+    }
+}
+
+/* palloc() and get frame. If there is no available page, evict the page
+ * and return it. This always return valid address. That is, if the user pool
+ * memory is full, this function evicts the frame to get the available memory
+ * space.  The frame is pinned until the caller has filled it. */
+static struct frame *
+vm_get_frame (void) {
+	struct frame* new_frame;
+
+    lock_acquire(&frame_lock);
+    new_frame = frame_alloc();
+    lock_release(&frame_lock);
 
     return new_frame;
 }
@@ -203,15 +606,48 @@ vm_stack_growth (void* addr) {
     }
 }
 
-/* Handle the fault on write_protected page */
+/* Handle the fault on write_protected page.
+ * A writable page is mapped read-only while its frame is shared with
+ * another process after fork().  The last sharer takes the frame over;
+ * any other gets a private copy.  If the frame was evicted since the
+ * fault, the page is read back into a private frame instead. */
 static bool
-vm_handle_wp (struct page *page UNUSED) {
+vm_handle_wp (struct page *page) {
+    struct frame* shared_frame;
+    struct frame* new_frame;
+    bool result = false;
+
+    if (!page->writable)
+        return false;
+
+    lock_acquire(&frame_lock);
+    frame_wait_evicted(page);
+    shared_frame = page->frame;
+    if (shared_frame != NULL) {
+        if (shared_frame->ref_cnt > 1) {
+            /* Keep SHARED_FRAME in place while this evicts. */
+            shared_frame->pinned = true;
+            new_frame = frame_alloc();
+            memcpy(new_frame->kva, shared_frame->kva, PGSIZE);
+            shared_frame->pinned = false;
+
+            frame_detach(page);
+            frame_attach(new_frame, page);
+            new_frame->pinned = false;
+        }
+
+        result = pml4_set_page(page->pml4, page->va, page->frame->kva, true);
+    }
+    lock_release(&frame_lock);
+
+    if (shared_frame == NULL)
+        result = vm_do_claim_page(page);
+    return result;
 }
 
 /* Return true on success */
-bool
-vm_try_handle_fault (struct intr_frame* f, void *addr,
-		bool user UNUSED, bool write UNUSED, bool not_present) {
+static bool
+vm_handle_fault (struct intr_frame* f, void *addr, bool write, bool not_present) {
     bool result;
     void* thread_rsp;
 
@@ -224,6 +660,12 @@ vm_try_handle_fault (struct intr_frame* f, void *addr,
     else
         thread_rsp = f->rsp;
 
+    /* A write to a present page can only be copy-on-write. */
+    if (!not_present) {
+        struct page* page = spt_find_page(&thread_current()->spt, addr);
+        return write && page != NULL && vm_handle_wp(page);
+    }
+
     result = vm_claim_page(addr);
 
     if (!result) {
@@ -236,6 +678,20 @@ vm_try_handle_fault (struct intr_frame* f, void *addr,
     return result;
 }
 
+/* Handles a fault at ADDR and records how long it took.
+ * Return true on success */
+bool
+vm_try_handle_fault (struct intr_frame* f, void *addr,
+		bool user UNUSED, bool write, bool not_present) {
+    uint64_t start = rdtsc();
+    bool result = vm_handle_fault(f, addr, write, not_present);
+    uint64_t cycles = rdtsc() - start;
+
+    fault_hist[cycles > 1 ? 63 - __builtin_clzll(cycles) : 0]++;
+    fault_cnt++;
+    return result;
+}
+
 /* Free the page.
  * DO NOT MODIFY THIS FUNCTION. */
 void
@@ -262,106 +718,195 @@ static bool
 vm_do_claim_page (struct page* page) {
     bool result;
     struct thread* curr = thread_current();
-    /* Claim the page that allocate on VA. */
-    struct frame* frame = vm_get_frame();
+    struct frame* frame;
 
     ASSERT (page != NULL);
+
+    /* The page may still be on its way out to swap. */
+    lock_acquire(&frame_lock);
+    frame_wait_evicted(page);
+    lock_release(&frame_lock);
+
+    /* Claim the page that allocate on VA. */
+    frame = vm_get_frame();
     ASSERT (frame != NULL);
 
 	/* Set links */
-	frame->page = page;
-	page->frame = frame;
+    lock_acquire(&frame_lock);
+	frame_attach(frame, page);
+    lock_release(&frame_lock);
 
     result = (pml4_get_page(curr->pml4, page->va) == NULL) && (pml4_set_page(curr->pml4, page->va, frame->kva, page->writable));
 
     if (result)
-        return swap_in(page, frame->kva);
+        result = swap_in(page, frame->kva);
 
+    frame->pinned = false;
     return result;
 }
 
 /* Initialize new supplemental page table */
 void
 supplemental_page_table_init (struct supplemental_page_table *spt) {
-    struct hash* hash_table = (struct hash*) malloc(sizeof(struct hash));
+    /* Nodes of the radix tree are allocated on first insertion. */
+    spt->root = NULL;
+}
 
-    /* Initialize hash table used in supplemental page table. */
-    hash_init(hash_table, get_value_from_hash_table, compare_hash_value, NULL);
-    spt->hash_table = hash_table;
+/* Returns the frame of PAGE, which may belong to another process,
+ * pinned so that it is not evicted until the caller unpins it.  If
+ * PAGE was swapped out or, for a file page, dropped, it is read back
+ * into a new frame and mapped again in its own page map first.
+ * Returns NULL if it cannot be read back. */
+struct frame*
+page_pin_resident (struct page* page) {
+    struct frame* frame;
+
+    lock_acquire(&frame_lock);
+    frame_wait_evicted(page);
+    frame = page->frame;
+    if (frame != NULL) {
+        frame->pinned = true;
+        lock_release(&frame_lock);
+        return frame;
+    }
+    frame = frame_alloc();
+    frame_attach(frame, page);
+    lock_release(&frame_lock);
+
+    if (swap_in(page, frame->kva)
+            && pml4_set_page(page->pml4, page->va, frame->kva, page->writable))
+        return frame;
+
+    lock_acquire(&frame_lock);
+    pml4_clear_page(page->pml4, page->va);
+    frame_detach(page);
+    lock_release(&frame_lock);
+    return NULL;
 }
 
-/* Copy supplemental page table from src to dst */
-bool
-supplemental_page_table_copy (struct supplemental_page_table *dst, struct supplemental_page_table *src) {
-    void* source_aux;
-    void* source_page_va;
-    bool source_page_writable;
-    enum vm_type source_page_type;
-    vm_initializer* source_page_initializer;
-
-    struct hash_iterator iter_hash;
-    hash_first(&iter_hash, src->hash_table);
-    while (hash_next(&iter_hash)) {
-        struct page* source_page = hash_entry(hash_cur(&iter_hash), struct page, elem_for_hash_table);
-
-        source_aux = source_page->uninit.aux;
-        source_page_va = source_page->va;
-        source_page_writable = source_page->writable;
-        source_page_type = page_get_type(source_page);
-        source_page_initializer= source_page->uninit.init;
-
-        if (source_page->uninit.type & VM_MARKER_0)
-            setup_stack(&thread_current()->tf);
-        else if (source_page->operations->type == VM_UNINIT) {
-            if (!vm_alloc_page_with_initializer(source_page_type, source_page_va, source_page_writable, source_page_initializer, source_aux))
-                return false;
-        }
-        else {
-            if(!(vm_alloc_page(source_page_type, source_page_va, source_page_writable) && vm_claim_page(source_page_va) ))
-                return false;
-        }
+/* Adds to the supplemental page table of the current thread a copy
+ * of the anonymous SOURCE_PAGE, which belongs to the parent, that
+ * shares its contents instead of copying them.  A resident page
+ * shares the frame: both mappings become read-only, and the first
+ * write on either side copies the frame in vm_handle_wp().  A page
+ * that was swapped out shares the swap slot, and each side reads it
+ * back into a frame of its own.  FRAME_LOCK must be held, and
+ * SOURCE_PAGE must not be on its way out to swap. */
+static bool
+share_page (struct page* source_page) {
+    struct thread* curr = thread_current();
+    struct frame* frame = source_page->frame;
+    struct page* new_page;
 
-        if (source_page->operations->type != VM_UNINIT) {
-            struct page* dest_page = spt_find_page(dst, source_page_va);
-            memcpy(dest_page->frame->kva, source_page->frame->kva, PGSIZE);
-        }
+    if (frame == NULL && source_page->anon.swap_slot == SWAP_SLOT_NONE)
+        return false;
+
+    new_page = kmem_cache_alloc(page_cache);
+    if (new_page == NULL)
+        return false;
+
+    memcpy(new_page, source_page, sizeof(struct page));
+    new_page->frame = NULL;
+    new_page->pml4 = curr->pml4;
+    if (!spt_insert_page(&curr->spt, new_page)) {
+        kmem_cache_free(page_cache, new_page);
+        return false;
     }
-    return true;
-}
 
-static void
-hash_destroy_func(struct hash_elem* target_elem, void* aux UNUSED) {
-    struct page* target_page = hash_entry(target_elem, struct page, elem_for_hash_table);
-    free(target_page);
+    if (frame == NULL) {
+        swap_slot_dup(new_page->anon.swap_slot);
+        return true;
+    }
+    frame_attach(frame, new_page);
+
+    return pml4_set_page(curr->pml4, new_page->va, frame->kva, false)
+        && pml4_set_page(source_page->pml4, source_page->va, frame->kva, false);
 }
 
-/* Free the resource hold by the supplemental page table */
-void
-supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
-    struct page* target_page;
-    struct hash_iterator iter_hash;
-
-    /* Initializes I for iterating hash table H. */
-    hash_first(&iter_hash, spt->hash_table);
-    while (hash_next(&iter_hash)) {
-        target_page = hash_entry(hash_cur(&iter_hash), struct page, elem_for_hash_table);
-        if (target_page->operations->type == VM_FILE)
-            do_munmap(target_page->va);
+/* Copies SOURCE_PAGE of the parent into the supplemental page table
+ * of the current thread.  Anonymous pages, stack pages among them,
+ * are shared copy-on-write, even if they were swapped out.  File
+ * pages are copied, and are first brought back in if they were
+ * evicted. */
+static bool
+copy_page (struct page* source_page, void* aux UNUSED) {
+    void* source_page_va = source_page->va;
+    bool source_page_writable = source_page->writable;
+    struct frame* source_frame;
+    struct page* dest_page;
+    bool result;
+
+    if (source_page->operations->type == VM_UNINIT)
+        return vm_alloc_page_with_initializer(page_get_type(source_page),
+                source_page_va, source_page_writable,
+                source_page->uninit.init, source_page->uninit.aux);
+
+    if (source_page->operations->type == VM_ANON) {
+        lock_acquire(&frame_lock);
+        frame_wait_evicted(source_page);
+        result = share_page(source_page);
+        lock_release(&frame_lock);
+        return result;
     }
 
-    hash_destroy(spt->hash_table, hash_destroy_func);
+    source_frame = page_pin_resident(source_page);
+    if (source_frame == NULL)
+        return false;
+
+    result = vm_alloc_page(page_get_type(source_page), source_page_va, source_page_writable)
+        && vm_claim_page(source_page_va);
+    if (result) {
+        dest_page = spt_find_page(&thread_current()->spt, source_page_va);
+        memcpy(dest_page->frame->kva, source_frame->kva, PGSIZE);
+    }
+    source_frame->pinned = false;
+    return result;
 }
 
-static uint64_t
-get_value_from_hash_table (struct hash_elem* target_elem, void* aux UNUSED)
-{
-    struct page* target_page = hash_entry(target_elem, struct page, elem_for_hash_table);
-    return hash_bytes(&(target_page->va), sizeof target_page->va);
+/* Copy supplemental page table from src to dst, which belongs to the
+ * current thread. */
+bool
+supplemental_page_table_copy (struct supplemental_page_table *dst, struct supplemental_page_table *src) {
+    ASSERT (dst == &thread_current()->spt);
+
+    return spt_for_each(src, NULL, (void*) KERN_BASE, copy_page, NULL);
 }
 
+/* Writes back the mapping that starts at a file-backed PAGE. */
 static bool
-compare_hash_value (struct hash_elem* first_elem, struct hash_elem* second_elem, void *aux UNUSED) {
-    const struct page* first_page = hash_entry(first_elem, struct page, elem_for_hash_table);
-    const struct page* second_page = hash_entry(second_elem, struct page, elem_for_hash_table);
-    return first_page->va < second_page->va;
+unmap_file_page (struct page* target_page, void* aux UNUSED) {
+    if (target_page->operations->type == VM_FILE)
+        do_munmap(target_page->va);
+    return true;
+}
+
+/* Frees PAGE, dropping its reference to its frame and running its
+ * destructor, which gives back its swap slot.  Unmapping first keeps
+ * pml4_destroy() from freeing a frame that a forked process still
+ * shares. */
+static bool
+free_page (struct page* target_page, void* aux UNUSED) {
+    lock_acquire(&frame_lock);
+    frame_wait_evicted(target_page);
+    if (target_page->frame != NULL) {
+        pml4_clear_page(target_page->pml4, target_page->va);
+        frame_detach(target_page);
+    }
+    lock_release(&frame_lock);
+    destroy(target_page);
+    kmem_cache_free(page_cache, target_page);
+    return true;
+}
+
+/* Free the resource hold by the supplemental page table */
+void
+supplemental_page_table_kill (struct supplemental_page_table *spt) {
+    if (spt->root == NULL)
+        return;
+
+    spt_for_each(spt, NULL, (void*) KERN_BASE, unmap_file_page, NULL);
+    spt_for_each(spt, NULL, (void*) KERN_BASE, free_page, NULL);
+
+    spt_node_destroy(spt->root, 0);
+    spt->root = NULL;
 }
\ No newline at end of file